@@ -0,0 +1,518 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <thread>
+
+#include "shiva/shiva_client.hpp"
+#include "shiva/shiva_mock_server.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Benchmark configuration, filled from the command line.
+ */
+struct BenchOptions
+{
+    std::string host = "127.0.0.1";
+    unsigned short port = 6174;
+    int connections = 1;
+    int threads = 1;
+    int tensors = 1;
+    std::vector<uint32_t> shape = {640, 480, 3};
+    std::string dtype = "uint8";
+    int metadataBytes = 0;
+    shiva::TensorCodec codec;
+    std::string namespace_ = "bench";
+    double rate = 0;      // total target msgs/s, 0 means closed loop
+    double duration = 10; // seconds
+    double warmup = 1;    // seconds
+    int timeoutMs = 5000;
+    bool local = false; // run against an in-process echo server
+};
+
+/**
+ * Per-thread counters, merged at the end of the run.
+ */
+struct WorkerStats
+{
+    std::vector<double> latenciesUs;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;     // uncompressed messages
+    uint64_t wireBytes = 0; // as sent on the socket
+    uint64_t errors = 0;
+};
+
+template <typename DataType>
+shiva::BaseTensorPtr createTensor(const std::vector<uint32_t> &shape)
+{
+    size_t total_size = 1;
+    std::for_each(shape.begin(), shape.end(), [&](uint32_t n) { total_size *= n; });
+
+    std::shared_ptr<shiva::Tensor<DataType>> tensor =
+        std::make_shared<shiva::Tensor<DataType>>();
+
+    tensor->data.resize(total_size);
+    for (size_t i = 0; i < total_size; i++)
+        tensor->data[i] = (DataType)(i % 127);
+    tensor->shape = shape;
+    return tensor;
+}
+
+shiva::BaseTensorPtr createTensor(const std::string &dtype,
+                                  const std::vector<uint32_t> &shape)
+{
+    if (dtype == "float32")
+        return createTensor<float>(shape);
+    if (dtype == "float64")
+        return createTensor<double>(shape);
+    if (dtype == "uint8")
+        return createTensor<uint8_t>(shape);
+    if (dtype == "int8")
+        return createTensor<int8_t>(shape);
+    if (dtype == "uint16")
+        return createTensor<uint16_t>(shape);
+    if (dtype == "int16")
+        return createTensor<int16_t>(shape);
+    if (dtype == "uint32")
+        return createTensor<uint32_t>(shape);
+    if (dtype == "int32")
+        return createTensor<int>(shape);
+    if (dtype == "uint64")
+        return createTensor<unsigned long>(shape);
+    if (dtype == "int64")
+        return createTensor<long>(shape);
+    throw std::runtime_error("shiva-bench unknown dtype " + dtype);
+}
+
+/**
+ * Number of bytes the message framing takes besides the tensor data.
+ */
+size_t framingSize(shiva::ShivaMessage &message)
+{
+    size_t size = sizeof(shiva::MessageHeader);
+    for (auto &tensor : message.tensors)
+        size += sizeof(shiva::TensorHeader) + sizeof(uint32_t) * tensor->shape.size();
+    size += message.metadata.dump().size();
+    size += message.namespace_.size();
+    return size;
+}
+
+/**
+ * Number of bytes the message would occupy on the wire without tensor compression.
+ */
+size_t logicalSize(shiva::ShivaMessage &message)
+{
+    size_t size = framingSize(message);
+    for (auto &tensor : message.tensors)
+    {
+        size_t elements = 1;
+        for (uint32_t n : tensor->shape)
+            elements *= n;
+        size += elements * shiva::TensorDtypeSize(shiva::TensorTypeMap.at(tensor->type));
+    }
+    return size;
+}
+
+/**
+ * Number of bytes the message took on the wire when it was last sent or received.
+ */
+size_t wireSize(shiva::ShivaMessage &message)
+{
+    size_t size = framingSize(message);
+    for (auto &tensor : message.tensors)
+        size += tensor->wireDataSize;
+    return size;
+}
+
+shiva::ShivaMessage buildMessage(const BenchOptions &options)
+{
+    shiva::ShivaMessage message;
+    std::vector<std::string> names;
+    for (int i = 0; i < options.tensors; i++)
+    {
+        message.tensors.push_back(createTensor(options.dtype, options.shape));
+        message.tensors.back()->codec = options.codec;
+        names.push_back("tensor_" + std::to_string(i + 1));
+    }
+
+    message.metadata = {{"__tensors__", names}};
+    if (options.metadataBytes > 0)
+        message.metadata["padding"] = std::string(options.metadataBytes, 'x');
+    message.namespace_ = options.namespace_;
+    return message;
+}
+
+shiva::TensorCodec parseCodec(const std::string &text)
+{
+    shiva::TensorCodec codec;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (item == "shuffle")
+            codec.shuffle = true;
+        else if (item == "delta")
+            codec.delta = true;
+        else if (item == "lz")
+            codec.lz = true;
+        else if (item != "none")
+            throw std::runtime_error("shiva-bench unknown codec stage " + item);
+    }
+    return codec;
+}
+
+std::vector<uint32_t> parseShape(const std::string &text)
+{
+    std::vector<uint32_t> shape;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, 'x'))
+        shape.push_back((uint32_t)std::stoul(item));
+    return shape;
+}
+
+void printUsage(const char *name)
+{
+    std::cout
+        << "Usage: " << name << " [options]\n"
+        << "  --host <ip>             server address (default 127.0.0.1)\n"
+        << "  --port <port>           server port (default 6174)\n"
+        << "  --connections <n>       number of client connections (default 1)\n"
+        << "  --threads <n>           worker threads polling the connections "
+           "(default 1)\n"
+        << "  --tensors <n>           tensors per message (default 1)\n"
+        << "  --shape <AxBxC>         tensor shape (default 640x480x3)\n"
+        << "  --dtype <name>          uint8 int8 uint16 int16 uint32 int32 uint64 "
+           "int64 float32 float64\n"
+        << "  --metadata-bytes <n>    extra metadata payload size (default 0)\n"
+        << "  --codec <stages>        tensor codec, comma separated shuffle,delta,lz "
+           "(default none)\n"
+        << "  --namespace <name>      message namespace (default bench)\n"
+        << "  --rate <msgs/s>         open loop at a fixed total rate, 0 for closed "
+           "loop (default 0)\n"
+        << "  --duration <s>          measured run length (default 10)\n"
+        << "  --warmup <s>            discarded warmup length (default 1)\n"
+        << "  --timeout <ms>          socket timeout (default 5000)\n"
+        << "  --local                 start an in-process echo server and target it\n";
+}
+
+BenchOptions parseOptions(int argc, char *argv[])
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            exit(0);
+        }
+        if (arg == "--local")
+        {
+            options.local = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            exit(1);
+        }
+
+        std::string value = argv[++i];
+        try
+        {
+            if (arg == "--host")
+                options.host = value;
+            else if (arg == "--port")
+                options.port = (unsigned short)std::stoi(value);
+            else if (arg == "--connections")
+                options.connections = std::stoi(value);
+            else if (arg == "--threads")
+                options.threads = std::stoi(value);
+            else if (arg == "--tensors")
+                options.tensors = std::stoi(value);
+            else if (arg == "--shape")
+                options.shape = parseShape(value);
+            else if (arg == "--dtype")
+                options.dtype = value;
+            else if (arg == "--metadata-bytes")
+                options.metadataBytes = std::stoi(value);
+            else if (arg == "--codec")
+                options.codec = parseCodec(value);
+            else if (arg == "--namespace")
+                options.namespace_ = value;
+            else if (arg == "--rate")
+                options.rate = std::stod(value);
+            else if (arg == "--duration")
+                options.duration = std::stod(value);
+            else if (arg == "--warmup")
+                options.warmup = std::stod(value);
+            else if (arg == "--timeout")
+                options.timeoutMs = std::stoi(value);
+            else
+            {
+                std::cerr << "Unknown option " << arg << std::endl;
+                printUsage(argv[0]);
+                exit(1);
+            }
+        }
+        catch (const std::logic_error &)
+        {
+            // thrown by std::stoi/std::stod on bad or out of range numbers
+            throw std::runtime_error("shiva-bench invalid value " + value + " for " +
+                                     arg);
+        }
+    }
+
+    if (options.connections < 1 || options.threads < 1 || options.tensors < 0 ||
+        options.shape.empty())
+        throw std::runtime_error("shiva-bench invalid connections/threads/tensors/shape");
+    // fail here rather than in the workers on an unknown dtype
+    createTensor(options.dtype, {1});
+    // a thread without connections would idle, never spawn more threads than needed
+    options.threads = std::min(options.threads, options.connections);
+    return options;
+}
+
+/**
+ * A connection with at most one request in flight.
+ */
+struct Connection
+{
+    std::unique_ptr<shiva::ShivaClient> client;
+    shiva::ShivaMessage message;
+    bool inFlight = false;
+    Clock::time_point start;  // latency origin, scheduled time in open loop
+    Clock::time_point sentAt; // actual send time, the response timeout runs from here
+    Clock::time_point next;  // next scheduled send, open loop only
+};
+
+/**
+ * Drive the given connections from a single thread, polling them so that every
+ * connection has its own request in flight.
+ *
+ * In closed loop every connection sends its next message as soon as the previous
+ * response arrived. In open loop each connection schedules its messages at a fixed
+ * interval and the latency is measured from the scheduled time rather than from the
+ * actual send, so that a slow server is not hidden by the client backing off
+ * (coordinated omission).
+ */
+void runWorker(const BenchOptions &options, int connections, double rate,
+               Clock::time_point measureStart, Clock::time_point stop,
+               std::atomic<bool> &failed, WorkerStats &stats)
+{
+    std::chrono::nanoseconds interval(0);
+    if (rate > 0)
+        interval = std::chrono::nanoseconds((int64_t)(1e9 * connections / rate));
+
+    std::vector<Connection> pool(connections);
+    Clock::time_point now = Clock::now();
+    for (int i = 0; i < connections; i++)
+    {
+        pool[i].client = std::make_unique<shiva::ShivaClient>(
+            options.host, options.port, options.timeoutMs);
+        pool[i].message = buildMessage(options);
+        // spread the schedules, so that connections do not send in bursts
+        pool[i].next = now + interval * i / connections;
+    }
+    size_t bytesPerMessage = logicalSize(pool[0].message);
+    size_t wireBytesPerMessage = pool[0].message.serialize().size();
+    std::chrono::milliseconds timeout(options.timeoutMs > 0 ? options.timeoutMs : 5000);
+
+    std::vector<struct pollfd> fds;
+    std::vector<Connection *> polled;
+    while (!failed && (now = Clock::now()) < stop)
+    {
+        Clock::time_point wakeup = stop;
+        fds.clear();
+        polled.clear();
+
+        for (Connection &connection : pool)
+        {
+            if (!connection.inFlight && (rate <= 0 || connection.next <= now))
+            {
+                connection.start = rate > 0 ? connection.next : now;
+                connection.sentAt = now;
+                connection.next += interval;
+                connection.message.sendMessage(connection.client->fd());
+                connection.inFlight = true;
+            }
+
+            if (connection.inFlight)
+            {
+                // a growing open-loop backlog is measured, not a timeout
+                if (now - connection.sentAt > timeout)
+                    throw shiva::ShivaTimeoutException("Timeout while waiting response");
+                fds.push_back({connection.client->fd(), POLLIN, 0});
+                polled.push_back(&connection);
+            }
+            else
+            {
+                wakeup = std::min(wakeup, connection.next);
+            }
+        }
+
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::max(wakeup - now, Clock::duration(0)));
+        wait = std::min<std::chrono::nanoseconds>(wait, timeout);
+        struct timespec ts;
+        ts.tv_sec = wait.count() / 1000000000;
+        ts.tv_nsec = wait.count() % 1000000000;
+        if (ppoll(fds.data(), fds.size(), &ts, nullptr) < 0 && errno != EINTR)
+            throw std::runtime_error("shiva-bench poll failed");
+
+        for (size_t i = 0; i < fds.size(); i++)
+        {
+            if (fds[i].revents == 0)
+                continue;
+
+            Connection &connection = *polled[i];
+            shiva::ShivaMessage response =
+                shiva::ShivaMessage::receive(connection.client->fd());
+            Clock::time_point end = Clock::now();
+            connection.inFlight = false;
+
+            if (connection.start >= measureStart)
+            {
+                stats.latenciesUs.push_back(
+                    std::chrono::duration<double, std::micro>(end - connection.start)
+                        .count());
+                stats.messages++;
+                stats.bytes += bytesPerMessage + logicalSize(response);
+                stats.wireBytes += wireBytesPerMessage + wireSize(response);
+            }
+        }
+    }
+}
+
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    try
+    {
+        options = parseOptions(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Invalid arguments: " << e.what() << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<shiva::ShivaMockServer> localServer;
+    if (options.local)
+    {
+        localServer = std::make_unique<shiva::ShivaMockServer>();
+        options.host = "127.0.0.1";
+        options.port = localServer->port();
+    }
+
+    std::cout << "shiva-bench " << options.host << ":" << options.port << " "
+              << options.connections << " connections, " << options.threads
+              << " threads, " << options.tensors << "x" << options.dtype << " tensors"
+              << std::endl;
+    if (options.codec.enabled())
+    {
+        shiva::ShivaMessage message = buildMessage(options);
+        std::cout << "codec: " << message.serialize().size() << " bytes on the wire, "
+                  << logicalSize(message) << " uncompressed" << std::endl;
+    }
+    if (options.rate > 0)
+        std::cout << "open loop @ " << options.rate << " msgs/s" << std::endl;
+    else
+        std::cout << "closed loop" << std::endl;
+
+    std::vector<WorkerStats> stats(options.threads);
+    std::vector<std::thread> workers;
+    std::atomic<bool> failed(false);
+
+    Clock::time_point begin = Clock::now();
+    Clock::time_point measureStart =
+        begin + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options.warmup));
+    Clock::time_point stop =
+        measureStart + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(options.duration));
+
+    for (int t = 0; t < options.threads; t++)
+    {
+        // spread connections (and the target rate) evenly among the threads
+        int connections = options.connections / options.threads +
+                          (t < options.connections % options.threads ? 1 : 0);
+        double rate = options.rate * connections / options.connections;
+        workers.emplace_back(
+            [&, t, connections, rate]()
+            {
+                try
+                {
+                    runWorker(options, connections, rate, measureStart, stop, failed,
+                              stats[t]);
+                }
+                catch (const std::exception &e)
+                {
+                    // a broken connection can not be resynchronized, stop the run
+                    std::cerr << "Connection error: " << e.what() << std::endl;
+                    stats[t].errors++;
+                    failed = true;
+                }
+            });
+    }
+
+    for (auto &worker : workers)
+        worker.join();
+
+    // a run failing during warmup ends before the measurement starts
+    double elapsed = std::max(
+        0.0, std::chrono::duration<double>(std::min(Clock::now(), stop) - measureStart)
+                 .count());
+
+    WorkerStats total;
+    for (auto &s : stats)
+    {
+        total.latenciesUs.insert(total.latenciesUs.end(), s.latenciesUs.begin(),
+                                 s.latenciesUs.end());
+        total.messages += s.messages;
+        total.bytes += s.bytes;
+        total.wireBytes += s.wireBytes;
+        total.errors += s.errors;
+    }
+    std::sort(total.latenciesUs.begin(), total.latenciesUs.end());
+
+    double mean = 0;
+    for (double l : total.latenciesUs)
+        mean += l;
+    if (!total.latenciesUs.empty())
+        mean /= total.latenciesUs.size();
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "messages:   " << total.messages << " (" << total.errors
+              << " errors) in " << elapsed << " s" << std::endl;
+    if (elapsed > 0)
+    {
+        // MB/s sent and received, of uncompressed messages and on the socket
+        std::cout << "throughput: " << total.messages / elapsed << " msgs/s, "
+                  << total.bytes / elapsed / 1e6 << " MB/s logical, "
+                  << total.wireBytes / elapsed / 1e6 << " MB/s wire" << std::endl;
+    }
+    std::cout << "latency us: mean " << mean << "  p50 "
+              << percentile(total.latenciesUs, 50) << "  p99 "
+              << percentile(total.latenciesUs, 99) << "  p99.9 "
+              << percentile(total.latenciesUs, 99.9) << "  max "
+              << (total.latenciesUs.empty() ? 0 : total.latenciesUs.back())
+              << std::endl;
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+#include <iostream>
+
+#include "shiva/shiva_replay.hpp"
+
+void printUsage(const char *name)
+{
+    std::cout << "Usage: " << name << " <capture> <server_ip> <server_port> [speed]"
+              << std::endl;
+    std::cout << "  speed: 1 replays at recorded speed (default), 0 at max speed"
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    int port = 0;
+    double speed = 1.0;
+    try
+    {
+        port = std::stoi(argv[3]);
+        if (argc > 4)
+            speed = std::stod(argv[4]);
+    }
+    catch (const std::logic_error &)
+    {
+        // thrown by std::stoi/std::stod on bad or out of range numbers
+        port = -1;
+    }
+    if (port <= 0 || port > 65535 || speed < 0)
+    {
+        std::cerr << "Invalid arguments" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    shiva::ShivaReplayStats stats;
+    try
+    {
+        // open the capture and connect to the server
+        shiva::ShivaCaptureReader capture(argv[1]);
+        shiva::ShivaClient client(argv[2], port, 5000);
+
+        std::cout << "Replaying " << capture.size() << " records from " << capture.path
+                  << std::endl;
+
+        shiva::ShivaReplayer replayer(capture);
+        stats = replayer.replay(client, speed);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "shiva-replay error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "messages: " << stats.messages << " in " << stats.seconds << " s";
+    if (stats.messages > 0 && stats.seconds > 0)
+        std::cout << ", " << stats.messages / stats.seconds << " msgs/s, "
+                  << stats.bytesSent / stats.seconds / 1e6 << " MB/s sent";
+    std::cout << std::endl;
+}
@@ -0,0 +1,441 @@
+#ifndef SHIVA_CAPTURE_HPP
+#define SHIVA_CAPTURE_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shiva/shiva_message.hpp"
+
+namespace shiva
+{
+    /*
+    Capture format, all integers big endian like the wire framing.
+
+    <name>          append-only capture file
+        CaptureFileHeader
+        { CaptureRecordHeader, <record size bytes of ShivaMessage wire framing> }*
+
+    <name>.idx      side index, one entry per record, rebuilt from the capture file
+                    when missing or out of date
+        CaptureFileHeader
+        { CaptureIndexEntry }*
+    */
+
+    enum class CaptureDirection : uint8_t
+    {
+        Sent = 0,
+        Received = 1,
+    };
+
+    struct CaptureFileHeader
+    {
+        uint8_t MAGIC[8];
+        be_uint32_t version;
+        be_uint32_t reserved;
+
+        CaptureFileHeader() {}
+        CaptureFileHeader(const char *magic)
+        {
+            memcpy(this->MAGIC, magic, sizeof(this->MAGIC));
+            this->version = 1;
+            this->reserved = 0;
+        }
+
+        bool matches(const char *magic) const
+        {
+            return memcmp(this->MAGIC, magic, sizeof(this->MAGIC)) == 0 &&
+                   this->version == 1;
+        }
+    } __attribute__((packed));
+
+    inline const char *CaptureMagic = "SHIVACAP";
+    inline const char *CaptureIndexMagic = "SHIVAIDX";
+
+    struct CaptureRecordHeader
+    {
+        be_uint64_t timestamp_ns; // system clock, nanoseconds since epoch
+        be_uint64_t size;
+        uint8_t direction = 0;
+        uint8_t reserved[7] = {};
+    } __attribute__((packed));
+
+    struct CaptureIndexEntry
+    {
+        be_uint64_t offset; // offset of the wire framing in the capture file
+        be_uint64_t size;
+        be_uint64_t timestamp_ns;
+        uint8_t direction = 0;
+        uint8_t reserved[7] = {};
+    } __attribute__((packed));
+
+    /**
+     * Locate the complete records of a capture, data points to the whole file
+     * (header included). A truncated trailing record is ignored.
+     */
+    inline std::vector<CaptureIndexEntry> ScanCapture(const uint8_t *data, size_t size)
+    {
+        std::vector<CaptureIndexEntry> entries;
+        size_t offset = sizeof(CaptureFileHeader);
+        while (size - offset >= sizeof(CaptureRecordHeader))
+        {
+            CaptureRecordHeader header;
+            memcpy(&header, data + offset, sizeof(header));
+            offset += sizeof(header);
+
+            if (header.size > size - offset)
+                break;
+
+            CaptureIndexEntry entry;
+            entry.offset = offset;
+            entry.size = header.size;
+            entry.timestamp_ns = header.timestamp_ns;
+            entry.direction = header.direction;
+            entries.push_back(entry);
+            offset += header.size;
+        }
+        return entries;
+    }
+
+    /**
+     * Append-only writer of a capture file and of its side index.
+     *
+     * An existing capture is only appended to when it starts with the capture
+     * header; a trailing record cut by a crash is truncated away first and the side
+     * index is rewritten when it does not match the capture.
+     */
+    class ShivaCaptureWriter
+    {
+    public:
+        ShivaCaptureWriter(const std::string &path) : path(path)
+        {
+            std::vector<CaptureIndexEntry> entries;
+            m_file = openCapture(path, entries);
+            try
+            {
+                m_index = openIndex(path + ".idx", entries);
+            }
+            catch (...)
+            {
+                // the destructor does not run for a throwing constructor
+                fclose(m_file);
+                throw;
+            }
+            m_offset = ftell(m_file);
+        }
+
+        ShivaCaptureWriter(const ShivaCaptureWriter &) = delete;
+        ShivaCaptureWriter &operator=(const ShivaCaptureWriter &) = delete;
+
+        ~ShivaCaptureWriter()
+        {
+            fclose(m_file);
+            fclose(m_index);
+        }
+
+        /**
+         * Append a message already serialized in wire framing.
+         */
+        void write(CaptureDirection direction, const uint8_t *data, size_t size)
+        {
+            uint64_t timestamp =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+
+            CaptureRecordHeader header;
+            header.timestamp_ns = timestamp;
+            header.size = size;
+            header.direction = (uint8_t)direction;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            CaptureIndexEntry entry;
+            entry.offset = m_offset + sizeof(CaptureRecordHeader);
+            entry.size = size;
+            entry.timestamp_ns = timestamp;
+            entry.direction = (uint8_t)direction;
+
+            if (fwrite(&header, sizeof(header), 1, m_file) != 1 ||
+                (size > 0 && fwrite(data, size, 1, m_file) != 1))
+                throw std::runtime_error("ShivaCaptureWriter write failed");
+            if (fwrite(&entry, sizeof(entry), 1, m_index) != 1)
+                throw std::runtime_error("ShivaCaptureWriter index write failed");
+
+            m_offset += sizeof(CaptureRecordHeader) + size;
+        }
+
+        void write(CaptureDirection direction, ShivaMessage &message)
+        {
+            std::vector<uint8_t> buffer = message.serialize();
+            this->write(direction, buffer.data(), buffer.size());
+        }
+
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            fflush(m_file);
+            fflush(m_index);
+        }
+
+        std::string path;
+
+    private:
+        static FILE *openCapture(const std::string &path,
+                                 std::vector<CaptureIndexEntry> &entries)
+        {
+            int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+            if (fd < 0)
+                throw std::runtime_error("ShivaCaptureWriter can not open " + path);
+
+            struct stat st;
+            if (fstat(fd, &st) < 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("ShivaCaptureWriter stat failed " + path);
+            }
+
+            if (st.st_size > 0)
+            {
+                size_t size = st.st_size;
+                if (!scanExisting(fd, size, entries))
+                {
+                    ::close(fd);
+                    throw std::runtime_error("ShivaCaptureWriter invalid capture " + path);
+                }
+
+                // records appended after a partial one would never be readable
+                size_t end = entries.empty() ? sizeof(CaptureFileHeader)
+                                             : entries.back().offset + entries.back().size;
+                if (end < size && ftruncate(fd, end) < 0)
+                {
+                    ::close(fd);
+                    throw std::runtime_error("ShivaCaptureWriter truncate failed " + path);
+                }
+            }
+
+            FILE *file = fdopen(fd, "ab");
+            if (file == nullptr)
+            {
+                ::close(fd);
+                throw std::runtime_error("ShivaCaptureWriter can not open " + path);
+            }
+
+            fseek(file, 0, SEEK_END);
+            if (ftell(file) == 0)
+            {
+                CaptureFileHeader header(CaptureMagic);
+                if (fwrite(&header, sizeof(header), 1, file) != 1)
+                {
+                    fclose(file);
+                    throw std::runtime_error("ShivaCaptureWriter write failed " + path);
+                }
+            }
+            return file;
+        }
+
+        static bool scanExisting(int fd, size_t size, std::vector<CaptureIndexEntry> &entries)
+        {
+            if (size < sizeof(CaptureFileHeader))
+                return false;
+
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+                return false;
+
+            CaptureFileHeader header;
+            memcpy(&header, mapping, sizeof(header));
+            bool valid = header.matches(CaptureMagic);
+            if (valid)
+                entries = ScanCapture((const uint8_t *)mapping, size);
+            munmap(mapping, size);
+            return valid;
+        }
+
+        /**
+         * Open the side index for appending, rewriting it from the entries found in
+         * the capture when its content differs (missing, stale or ahead).
+         */
+        static FILE *openIndex(const std::string &path,
+                               const std::vector<CaptureIndexEntry> &entries)
+        {
+            std::vector<uint8_t> expected(sizeof(CaptureFileHeader) +
+                                          entries.size() * sizeof(CaptureIndexEntry));
+            CaptureFileHeader header(CaptureIndexMagic);
+            memcpy(expected.data(), &header, sizeof(header));
+            if (!entries.empty())
+                memcpy(expected.data() + sizeof(header), entries.data(),
+                       entries.size() * sizeof(CaptureIndexEntry));
+
+            bool matches = false;
+            if (FILE *file = fopen(path.c_str(), "rb"))
+            {
+                std::vector<uint8_t> current(expected.size() + 1);
+                size_t read = fread(current.data(), 1, current.size(), file);
+                fclose(file);
+                matches = read == expected.size() &&
+                          memcmp(current.data(), expected.data(), read) == 0;
+            }
+
+            FILE *file = fopen(path.c_str(), matches ? "ab" : "wb");
+            if (file == nullptr)
+                throw std::runtime_error("ShivaCaptureWriter can not open " + path);
+
+            if (!matches && fwrite(expected.data(), expected.size(), 1, file) != 1)
+            {
+                fclose(file);
+                throw std::runtime_error("ShivaCaptureWriter write failed " + path);
+            }
+            return file;
+        }
+
+        FILE *m_file;
+        FILE *m_index;
+        uint64_t m_offset;
+        std::mutex m_mutex;
+    };
+
+    /**
+     * A single captured message, pointing into the memory mapped capture.
+     */
+    struct CaptureRecord
+    {
+        uint64_t timestampNs;
+        CaptureDirection direction;
+        const uint8_t *data;
+        size_t size;
+
+        /**
+         * Zero-copy view of the message, tensor data points into the mapping.
+         */
+        ShivaMessageView view() const { return ShivaMessageView::parse(data, size); }
+
+        ShivaMessage message() const { return this->view().toMessage(); }
+    };
+
+    /**
+     * Read only, memory mapped access to a capture file.
+     *
+     * The side index is used when it is consistent with the capture, otherwise
+     * records are located by scanning the capture file (e.g. after a crash while
+     * recording, when the index may lag behind).
+     */
+    class ShivaCaptureReader
+    {
+    public:
+        ShivaCaptureReader(const std::string &path) : path(path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("ShivaCaptureReader can not open " + path);
+
+            struct stat st;
+            if (fstat(fd, &st) < 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("ShivaCaptureReader stat failed " + path);
+            }
+            m_size = st.st_size;
+
+            if (m_size < sizeof(CaptureFileHeader))
+            {
+                ::close(fd);
+                throw std::runtime_error("ShivaCaptureReader invalid capture " + path);
+            }
+
+            void *mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapping == MAP_FAILED)
+                throw std::runtime_error("ShivaCaptureReader mmap failed " + path);
+            m_data = (const uint8_t *)mapping;
+
+            CaptureFileHeader header;
+            memcpy(&header, m_data, sizeof(header));
+            if (!header.matches(CaptureMagic))
+            {
+                munmap((void *)m_data, m_size);
+                throw std::runtime_error("ShivaCaptureReader invalid capture " + path);
+            }
+
+            if (!this->loadIndex(path + ".idx"))
+                this->scan();
+        }
+
+        ShivaCaptureReader(const ShivaCaptureReader &) = delete;
+        ShivaCaptureReader &operator=(const ShivaCaptureReader &) = delete;
+
+        ~ShivaCaptureReader() { munmap((void *)m_data, m_size); }
+
+        size_t size() const { return m_records.size(); }
+
+        const CaptureRecord &operator[](size_t index) const { return m_records[index]; }
+
+        std::vector<CaptureRecord>::const_iterator begin() const
+        {
+            return m_records.begin();
+        }
+
+        std::vector<CaptureRecord>::const_iterator end() const
+        {
+            return m_records.end();
+        }
+
+        std::string path;
+
+    private:
+        bool loadIndex(const std::string &indexPath)
+        {
+            FILE *file = fopen(indexPath.c_str(), "rb");
+            if (file == nullptr)
+                return false;
+
+            std::vector<CaptureRecord> records;
+            CaptureFileHeader header;
+            bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                         header.matches(CaptureIndexMagic);
+
+            CaptureIndexEntry entry;
+            uint64_t expected = sizeof(CaptureFileHeader) + sizeof(CaptureRecordHeader);
+            while (valid && fread(&entry, sizeof(entry), 1, file) == 1)
+            {
+                // entries must describe contiguous records within the mapping
+                if (entry.offset != expected || entry.size > m_size - entry.offset)
+                {
+                    valid = false;
+                    break;
+                }
+                records.push_back({entry.timestamp_ns,
+                                   (CaptureDirection)entry.direction,
+                                   m_data + entry.offset, (size_t)entry.size});
+                expected = entry.offset + entry.size + sizeof(CaptureRecordHeader);
+            }
+            fclose(file);
+
+            // an index that does not cover the whole capture is stale
+            uint64_t end = expected - sizeof(CaptureRecordHeader);
+            if (!valid || end != m_size)
+                return false;
+
+            m_records = std::move(records);
+            return true;
+        }
+
+        void scan()
+        {
+            m_records.clear();
+            for (const CaptureIndexEntry &entry : ScanCapture(m_data, m_size))
+                m_records.push_back({entry.timestamp_ns,
+                                     (CaptureDirection)entry.direction,
+                                     m_data + entry.offset, (size_t)entry.size});
+        }
+
+        const uint8_t *m_data;
+        size_t m_size;
+        std::vector<CaptureRecord> m_records;
+    };
+}
+
+#endif // SHIVA_CAPTURE_HPP
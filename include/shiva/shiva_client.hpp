@@ -1,6 +1,7 @@
 #ifndef SHIVA_CLIENT_HPP
 #define SHIVA_CLIENT_HPP
 
+#include "shiva/shiva_capture.hpp"
 #include "shiva/shiva_message.hpp"
 
 namespace shiva
@@ -59,10 +60,47 @@ namespace shiva
 
         ShivaMessage sendAndReceiveMessage(ShivaMessage &message)
         {
-            message.sendMessage(m_sock);
-            return ShivaMessage::receive(m_sock);
+            if (!m_recorder)
+            {
+                message.sendMessage(m_sock);
+                return ShivaMessage::receive(m_sock);
+            }
+
+            std::vector<uint8_t> buffer = message.serialize();
+            return this->sendAndReceiveRaw(buffer.data(), buffer.size());
+        }
+
+        /**
+         * Send a message already serialized in wire framing, e.g. straight from a
+         * memory mapped capture, and receive the response.
+         */
+        ShivaMessage sendAndReceiveRaw(const uint8_t *data, size_t size)
+        {
+            if (m_recorder)
+                m_recorder->write(CaptureDirection::Sent, data, size);
+
+            shiva::utils::SocketSend(m_sock, data, size, "Message");
+            ShivaMessage response = ShivaMessage::receive(m_sock);
+
+            // the response is recorded re-serialized, in the same wire framing
+            if (m_recorder)
+                m_recorder->write(CaptureDirection::Received, response);
+            return response;
+        }
+
+        /**
+         * Record every sent and received message into an append-only capture file
+         * (and its side index, path + ".idx"), see shiva_capture.hpp.
+         */
+        void startRecording(const std::string &path)
+        {
+            m_recorder = std::make_unique<ShivaCaptureWriter>(path);
         }
 
+        void stopRecording() { m_recorder.reset(); }
+
+        bool isRecording() const { return m_recorder != nullptr; }
+
         void close()
         {
             if (m_sock > 0)
@@ -74,12 +112,18 @@ namespace shiva
 
         ~ShivaClient() { close(); }
 
+        /**
+         * Underlying socket, e.g. to poll several clients for responses.
+         */
+        int fd() const { return m_sock; }
+
         std::string serverIp;
         unsigned short serverPort;
         int timeoutMs;
 
     private:
         int m_sock;
+        std::unique_ptr<ShivaCaptureWriter> m_recorder;
     };
 }
 
@@ -0,0 +1,734 @@
+#ifndef SHIVA_CODEC_HPP
+#define SHIVA_CODEC_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace shiva
+{
+    /**
+     * Set in TensorHeader::dtype when the tensor data is encoded with a codec. Peers
+     * without codec support do not know the resulting dtype and reject the message.
+     */
+    inline const uint8_t TensorCodecFlag = 0x80;
+
+    /**
+     * Per-tensor codec options, all disabled by default (raw big endian data).
+     *
+     * The data is split in chunks that are encoded independently, in parallel.
+     * Every chunk goes through the enabled stages in order: byte shuffle (groups the
+     * i-th byte of every element together), delta (each byte minus the previous one
+     * of the same shuffled plane) and the LZ compressor. Shuffle and delta make the
+     * slowly varying values of images and depth maps compress much better.
+     */
+    struct TensorCodec
+    {
+        bool shuffle = false;
+        bool delta = false;
+        bool lz = false;
+        uint32_t chunkSize = 1 << 20; // bytes of raw data per chunk
+        unsigned int threads = 0;     // encoding threads, 0 uses all cores
+
+        bool enabled() const { return shuffle || delta || lz; }
+    };
+
+    namespace codec
+    {
+        enum Filter : uint8_t
+        {
+            FilterShuffle = 1 << 0,
+            FilterDelta = 1 << 1,
+            FilterLZ = 1 << 2,
+        };
+
+        /**
+         * Header preceding the encoded data of a tensor, followed by n_chunks
+         * be_uint32_t encoded chunk sizes and by the chunks themselves. A chunk whose
+         * encoded size equals its raw size is stored as is, without LZ.
+         */
+        struct CodecHeader
+        {
+            uint8_t filters;
+            uint8_t reserved;
+            uint8_t chunk_size[4]; // big endian
+            uint8_t n_chunks[4];   // big endian
+        } __attribute__((packed));
+
+        inline void WriteBE32(uint8_t *dst, uint32_t value)
+        {
+            dst[0] = value >> 24;
+            dst[1] = value >> 16;
+            dst[2] = value >> 8;
+            dst[3] = value;
+        }
+
+        inline uint32_t ReadBE32(const uint8_t *src)
+        {
+            return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+                   ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+        }
+
+        /***
+         * Group the bytes of the elements by significance.
+         *
+         * @param src The data to shuffle.
+         * @param dst The shuffled data, same size of src.
+         * @param size The size of the data, a multiple of elementSize.
+         * @param elementSize The size of a single element.
+         */
+        inline void Shuffle(const uint8_t *src, uint8_t *dst, size_t size,
+                            size_t elementSize)
+        {
+            size_t elements = size / elementSize;
+            for (size_t b = 0; b < elementSize; b++)
+            {
+                uint8_t *plane = dst + b * elements;
+                for (size_t i = 0; i < elements; i++)
+                    plane[i] = src[i * elementSize + b];
+            }
+        }
+
+        inline void Unshuffle(const uint8_t *src, uint8_t *dst, size_t size,
+                              size_t elementSize)
+        {
+            size_t elements = size / elementSize;
+            for (size_t b = 0; b < elementSize; b++)
+            {
+                const uint8_t *plane = src + b * elements;
+                for (size_t i = 0; i < elements; i++)
+                    dst[i * elementSize + b] = plane[i];
+            }
+        }
+
+        /***
+         * Replace each byte with its difference from the previous byte of the same
+         * plane, in place.
+         *
+         * @param data The data to filter.
+         * @param size The size of the data.
+         * @param planeSize The size of a plane (the whole data if not shuffled).
+         */
+        inline void DeltaEncode(uint8_t *data, size_t size, size_t planeSize)
+        {
+            for (size_t start = 0; start < size; start += planeSize)
+            {
+                size_t end = std::min(start + planeSize, size);
+                for (size_t i = end - 1; i > start; i--)
+                    data[i] -= data[i - 1];
+            }
+        }
+
+        inline void DeltaDecode(uint8_t *data, size_t size, size_t planeSize)
+        {
+            for (size_t start = 0; start < size; start += planeSize)
+            {
+                size_t end = std::min(start + planeSize, size);
+                for (size_t i = start + 1; i < end; i++)
+                    data[i] += data[i - 1];
+            }
+        }
+
+        /*
+        LZ block format, a sequence of:
+            token           literal length (high nibble), match length - 4 (low nibble)
+            [length bytes]  when a nibble is 15, further bytes are added until one is
+                            smaller than 255
+            literals
+            offset          2 bytes little endian, distance of the match (absent in the
+                            last sequence, made of literals only)
+            [length bytes]  match length extension
+        */
+        static constexpr size_t LZMinMatch = 4;
+        static constexpr size_t LZMaxOffset = 65535;
+        static constexpr int LZHashBits = 14;
+
+        inline size_t LZBound(size_t size) { return size + size / 255 + 16; }
+
+        inline void LZWriteLength(std::vector<uint8_t> &dst, size_t length)
+        {
+            while (length >= 255)
+            {
+                dst.push_back(255);
+                length -= 255;
+            }
+            dst.push_back((uint8_t)length);
+        }
+
+        inline void LZWriteSequence(std::vector<uint8_t> &dst, const uint8_t *literals,
+                                    size_t literalLength, size_t offset,
+                                    size_t matchLength)
+        {
+            size_t matchCode = matchLength > 0 ? matchLength - LZMinMatch : 0;
+            uint8_t token = (uint8_t)(std::min<size_t>(literalLength, 15) << 4) |
+                            (uint8_t)std::min<size_t>(matchCode, 15);
+            dst.push_back(token);
+            if (literalLength >= 15)
+                LZWriteLength(dst, literalLength - 15);
+            dst.insert(dst.end(), literals, literals + literalLength);
+
+            if (matchLength == 0)
+                return;
+
+            dst.push_back((uint8_t)offset);
+            dst.push_back((uint8_t)(offset >> 8));
+            if (matchCode >= 15)
+                LZWriteLength(dst, matchCode - 15);
+        }
+
+        /***
+         * Compress a block with a greedy LZ77 matcher over a hash of 4 bytes.
+         *
+         * @param src The data to compress.
+         * @param size The size of the data.
+         * @return The compressed block.
+         */
+        inline std::vector<uint8_t> LZCompress(const uint8_t *src, size_t size)
+        {
+            std::vector<uint8_t> dst;
+            dst.reserve(LZBound(size));
+
+            // positions + 1 of the last occurrence of each hash, 0 means none
+            std::vector<uint32_t> table(1 << LZHashBits, 0);
+
+            size_t ip = 0;
+            size_t anchor = 0;
+            while (ip + LZMinMatch <= size)
+            {
+                uint32_t sequence;
+                memcpy(&sequence, src + ip, sizeof(sequence));
+                uint32_t hash = (sequence * 2654435761u) >> (32 - LZHashBits);
+                size_t ref = table[hash];
+                table[hash] = (uint32_t)(ip + 1);
+
+                if (ref > 0 && ip - (ref - 1) <= LZMaxOffset &&
+                    memcmp(src + ref - 1, src + ip, LZMinMatch) == 0)
+                {
+                    ref -= 1;
+                    size_t length = LZMinMatch;
+                    while (ip + length < size && src[ref + length] == src[ip + length])
+                        length++;
+
+                    LZWriteSequence(dst, src + anchor, ip - anchor, ip - ref, length);
+                    ip += length;
+                    anchor = ip;
+                }
+                else
+                {
+                    // skip faster through data that does not compress
+                    ip += 1 + ((ip - anchor) >> 6);
+                }
+            }
+
+            LZWriteSequence(dst, src + anchor, size - anchor, 0, 0);
+            return dst;
+        }
+
+        inline size_t LZReadLength(const uint8_t *src, size_t size, size_t &ip)
+        {
+            size_t length = 0;
+            uint8_t byte;
+            do
+            {
+                if (ip >= size)
+                    throw std::runtime_error("LZDecompress error, truncated length");
+                byte = src[ip++];
+                length += byte;
+            } while (byte == 255);
+            return length;
+        }
+
+        /***
+         * Decompress a block, checking every access against the buffers bounds.
+         *
+         * @param src The compressed block.
+         * @param size The size of the compressed block.
+         * @param dst The buffer for the decompressed data.
+         * @param dstSize The expected size of the decompressed data.
+         */
+        inline void LZDecompress(const uint8_t *src, size_t size, uint8_t *dst,
+                                 size_t dstSize)
+        {
+            size_t ip = 0;
+            size_t op = 0;
+            while (ip < size)
+            {
+                uint8_t token = src[ip++];
+
+                size_t literalLength = token >> 4;
+                if (literalLength == 15)
+                    literalLength += LZReadLength(src, size, ip);
+                if (literalLength > size - ip || literalLength > dstSize - op)
+                    throw std::runtime_error("LZDecompress error, invalid literals");
+                if (literalLength > 0)
+                    memcpy(dst + op, src + ip, literalLength);
+                ip += literalLength;
+                op += literalLength;
+
+                // the last sequence has no match
+                if (ip == size)
+                    break;
+
+                if (size - ip < 2)
+                    throw std::runtime_error("LZDecompress error, truncated offset");
+                size_t offset = src[ip] | (src[ip + 1] << 8);
+                ip += 2;
+
+                size_t matchLength = token & 15;
+                if (matchLength == 15)
+                    matchLength += LZReadLength(src, size, ip);
+                matchLength += LZMinMatch;
+
+                if (offset == 0 || offset > op || matchLength > dstSize - op)
+                    throw std::runtime_error("LZDecompress error, invalid match");
+
+                // byte by byte, the match may overlap the data being written
+                const uint8_t *match = dst + op - offset;
+                for (size_t i = 0; i < matchLength; i++)
+                    dst[op + i] = match[i];
+                op += matchLength;
+            }
+
+            if (op != dstSize)
+                throw std::runtime_error("LZDecompress error, size mismatch");
+        }
+
+        inline uint8_t Filters(const TensorCodec &options)
+        {
+            return (options.shuffle ? FilterShuffle : 0) |
+                   (options.delta ? FilterDelta : 0) | (options.lz ? FilterLZ : 0);
+        }
+
+        inline std::vector<uint8_t> EncodeChunk(const uint8_t *src, size_t size,
+                                                size_t elementSize, uint8_t filters)
+        {
+            std::vector<uint8_t> filtered(size);
+            size_t planeSize = size;
+            if (filters & FilterShuffle)
+            {
+                Shuffle(src, filtered.data(), size, elementSize);
+                planeSize = size / elementSize;
+            }
+            else
+            {
+                memcpy(filtered.data(), src, size);
+            }
+
+            if (filters & FilterDelta)
+                DeltaEncode(filtered.data(), size, planeSize);
+
+            if (filters & FilterLZ)
+            {
+                std::vector<uint8_t> compressed = LZCompress(filtered.data(), size);
+                // only keep the compressed data if it is actually smaller
+                if (compressed.size() < size)
+                    return compressed;
+            }
+            return filtered;
+        }
+
+        inline void DecodeChunk(const uint8_t *src, size_t size, uint8_t *dst,
+                                size_t dstSize, size_t elementSize, uint8_t filters)
+        {
+            std::vector<uint8_t> filtered(dstSize);
+            if (size == dstSize)
+                memcpy(filtered.data(), src, size);
+            else if (filters & FilterLZ)
+                LZDecompress(src, size, filtered.data(), dstSize);
+            else
+                throw std::runtime_error("Codec decode error, invalid chunk size");
+
+            size_t planeSize = dstSize;
+            if (filters & FilterShuffle)
+                planeSize = dstSize / elementSize;
+
+            if (filters & FilterDelta)
+                DeltaDecode(filtered.data(), dstSize, planeSize);
+
+            if (filters & FilterShuffle)
+                Unshuffle(filtered.data(), dst, dstSize, elementSize);
+            else
+                memcpy(dst, filtered.data(), dstSize);
+        }
+
+        /**
+         * Decoding threads used when tensors are received or parsed, 0 uses all
+         * cores. The receiver does not know the sender options, so this is a
+         * process-wide setting rather than a TensorCodec field.
+         */
+        inline std::atomic<unsigned int> DecodeThreads(0);
+
+        /**
+         * Process-wide pool of worker threads shared by all the encode and decode
+         * calls. Workers are started on demand and kept alive, the calling thread
+         * always takes part in the work of its own call.
+         */
+        class WorkerPool
+        {
+        public:
+            static WorkerPool &shared()
+            {
+                static WorkerPool pool;
+                return pool;
+            }
+
+            WorkerPool() {}
+            WorkerPool(const WorkerPool &) = delete;
+            WorkerPool &operator=(const WorkerPool &) = delete;
+
+            ~WorkerPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_wake.notify_all();
+                for (auto &worker : m_workers)
+                    worker.join();
+            }
+
+            /**
+             * Number of worker threads started so far.
+             */
+            size_t size()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_workers.size();
+            }
+
+            /***
+             * Number of threads actually used for count jobs, 0 threads uses all
+             * cores.
+             */
+            static unsigned int threadsFor(size_t count, unsigned int threads)
+            {
+                if (threads == 0)
+                    threads = std::max(1u, std::thread::hardware_concurrency());
+                return (unsigned int)std::min<size_t>(threads, count);
+            }
+
+            /***
+             * Run job(i) for every i in [0, count) on up to threads threads, the
+             * calling one included, 0 threads uses all cores. The first exception
+             * thrown by a job is rethrown.
+             */
+            void run(size_t count, unsigned int threads,
+                     const std::function<void(size_t)> &job)
+            {
+                threads = threadsFor(count, threads);
+                if (threads <= 1)
+                {
+                    for (size_t i = 0; i < count; i++)
+                        job(i);
+                    return;
+                }
+
+                Batch batch;
+                batch.job = &job;
+                batch.count = count;
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    while (m_workers.size() < threads - 1)
+                        m_workers.emplace_back(&WorkerPool::loop, this);
+                    for (unsigned int t = 0; t < threads - 1; t++)
+                        m_queue.push_back(&batch);
+                }
+                m_wake.notify_all();
+
+                this->work(batch);
+
+                {
+                    // helpers that did not start yet are not needed anymore
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_queue.erase(std::remove(m_queue.begin(), m_queue.end(), &batch),
+                                  m_queue.end());
+                    m_done.wait(lock, [&]() { return batch.running == 0; });
+                }
+
+                if (batch.error)
+                    std::rethrow_exception(batch.error);
+            }
+
+        private:
+            struct Batch
+            {
+                const std::function<void(size_t)> *job = nullptr;
+                size_t count = 0;
+                std::atomic<size_t> next{0};
+                size_t running = 0; // helpers working on it, guarded by m_mutex
+                std::exception_ptr error;
+            };
+
+            void work(Batch &batch)
+            {
+                try
+                {
+                    size_t i;
+                    while ((i = batch.next.fetch_add(1)) < batch.count)
+                        (*batch.job)(i);
+                }
+                catch (...)
+                {
+                    batch.next = batch.count;
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (!batch.error)
+                        batch.error = std::current_exception();
+                }
+            }
+
+            void loop()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true)
+                {
+                    m_wake.wait(lock, [&]() { return m_stop || !m_queue.empty(); });
+                    if (m_stop)
+                        return;
+
+                    Batch *batch = m_queue.front();
+                    m_queue.pop_front();
+                    batch->running++;
+
+                    lock.unlock();
+                    this->work(*batch);
+                    lock.lock();
+
+                    if (--batch->running == 0)
+                        m_done.notify_all();
+                }
+            }
+
+            std::mutex m_mutex;
+            std::condition_variable m_wake;
+            std::condition_variable m_done;
+            std::deque<Batch *> m_queue;
+            std::vector<std::thread> m_workers;
+            bool m_stop = false;
+        };
+
+        /***
+         * Run job(i) for every i in [0, count) on up to threads threads, the calling
+         * one included, using the shared WorkerPool.
+         */
+        template <typename Job>
+        inline void ParallelFor(size_t count, unsigned int threads, Job job)
+        {
+            // serial runs do not need the shared pool at all
+            if (WorkerPool::threadsFor(count, threads) <= 1)
+            {
+                for (size_t i = 0; i < count; i++)
+                    job(i);
+                return;
+            }
+
+            WorkerPool::shared().run(count, threads, std::ref(job));
+        }
+
+        /***
+         * Encode raw tensor data.
+         *
+         * @param data The raw (big endian) tensor data.
+         * @param size The size of the data.
+         * @param elementSize The size of a single element.
+         * @param options The codec options.
+         * @return CodecHeader, chunk sizes and encoded chunks.
+         */
+        inline std::vector<uint8_t> Encode(const uint8_t *data, size_t size,
+                                           size_t elementSize,
+                                           const TensorCodec &options)
+        {
+            // chunks hold whole elements, so that they can be shuffled independently
+            size_t chunkSize = std::max<size_t>(options.chunkSize, elementSize);
+            chunkSize -= chunkSize % elementSize;
+            size_t nChunks = (size + chunkSize - 1) / chunkSize;
+            uint8_t filters = Filters(options);
+
+            std::vector<std::vector<uint8_t>> chunks(nChunks);
+            ParallelFor(nChunks, options.threads,
+                        [&](size_t i)
+                        {
+                            size_t offset = i * chunkSize;
+                            chunks[i] =
+                                EncodeChunk(data + offset,
+                                            std::min(chunkSize, size - offset),
+                                            elementSize, filters);
+                        });
+
+            CodecHeader header;
+            header.filters = filters;
+            header.reserved = 0;
+            WriteBE32(header.chunk_size, chunkSize);
+            WriteBE32(header.n_chunks, nChunks);
+
+            size_t total = sizeof(CodecHeader) + sizeof(uint32_t) * nChunks;
+            for (auto &chunk : chunks)
+                total += chunk.size();
+
+            std::vector<uint8_t> encoded(total);
+            uint8_t *out = encoded.data();
+            memcpy(out, &header, sizeof(header));
+            out += sizeof(header);
+            for (auto &chunk : chunks)
+            {
+                WriteBE32(out, chunk.size());
+                out += sizeof(uint32_t);
+            }
+            for (auto &chunk : chunks)
+            {
+                memcpy(out, chunk.data(), chunk.size());
+                out += chunk.size();
+            }
+            return encoded;
+        }
+
+        /***
+         * Size of the CodecHeader and of the chunk sizes table.
+         */
+        inline size_t PrefixSize(const CodecHeader &header)
+        {
+            return sizeof(CodecHeader) + sizeof(uint32_t) * ReadBE32(header.n_chunks);
+        }
+
+        /***
+         * Size of the encoded data, given its header and chunk sizes table.
+         */
+        inline size_t EncodedSize(const uint8_t *prefix)
+        {
+            CodecHeader header;
+            memcpy(&header, prefix, sizeof(header));
+            size_t total = PrefixSize(header);
+            uint32_t nChunks = ReadBE32(header.n_chunks);
+            for (uint32_t i = 0; i < nChunks; i++)
+                total += ReadBE32(prefix + sizeof(CodecHeader) + i * sizeof(uint32_t));
+            return total;
+        }
+
+        /***
+         * Reject filters this implementation does not know, e.g. written by a newer
+         * peer, instead of decoding their data into garbage.
+         */
+        inline void CheckFilters(const CodecHeader &header)
+        {
+            if ((header.filters & ~(FilterShuffle | FilterDelta | FilterLZ)) != 0 ||
+                header.reserved != 0)
+                throw std::runtime_error("Codec decode error, unsupported filters");
+        }
+
+        /***
+         * Check a CodecHeader against the raw data it must decode to, before its
+         * sizes are trusted to allocate anything.
+         *
+         * @param header The codec header, as received.
+         * @param dataSize The expected size of the raw data.
+         * @param elementSize The size of a single element.
+         */
+        inline void CheckHeader(const CodecHeader &header, size_t dataSize,
+                                size_t elementSize)
+        {
+            CheckFilters(header);
+
+            size_t chunkSize = ReadBE32(header.chunk_size);
+            size_t nChunks = ReadBE32(header.n_chunks);
+            if (chunkSize == 0 || chunkSize % elementSize != 0 ||
+                nChunks != (dataSize + chunkSize - 1) / chunkSize)
+                throw std::runtime_error("Codec decode error, invalid header");
+        }
+
+        /***
+         * Check the chunk sizes table following a valid CodecHeader: no chunk can be
+         * larger than its raw length, since such chunks are stored as is.
+         *
+         * @param prefix The codec header followed by the chunk sizes table.
+         * @param dataSize The expected size of the raw data.
+         * @return The size of the encoded data, prefix included.
+         */
+        inline size_t CheckChunkSizes(const uint8_t *prefix, size_t dataSize)
+        {
+            CodecHeader header;
+            memcpy(&header, prefix, sizeof(header));
+            size_t chunkSize = ReadBE32(header.chunk_size);
+            size_t nChunks = ReadBE32(header.n_chunks);
+
+            size_t total = PrefixSize(header);
+            for (size_t i = 0; i < nChunks; i++)
+            {
+                size_t size = ReadBE32(prefix + sizeof(CodecHeader) + i * sizeof(uint32_t));
+                if (size > std::min(chunkSize, dataSize - i * chunkSize))
+                    throw std::runtime_error("Codec decode error, invalid chunk size");
+                total += size;
+            }
+            return total;
+        }
+
+        /***
+         * Decode data produced by Encode, chunks are decoded in parallel.
+         *
+         * @param encoded The encoded data.
+         * @param size The size of the encoded data.
+         * @param data The buffer for the raw data.
+         * @param dataSize The expected size of the raw data.
+         * @param elementSize The size of a single element.
+         * @param threads Decoding threads, 0 uses all cores.
+         */
+        inline void Decode(const uint8_t *encoded, size_t size, uint8_t *data,
+                           size_t dataSize, size_t elementSize, unsigned int threads = 0)
+        {
+            CodecHeader header;
+            if (size < sizeof(header))
+                throw std::runtime_error("Codec decode error, truncated header");
+            memcpy(&header, encoded, sizeof(header));
+
+            CheckHeader(header, dataSize, elementSize);
+            if (size < PrefixSize(header))
+                throw std::runtime_error("Codec decode error, invalid header");
+            if (CheckChunkSizes(encoded, dataSize) != size)
+                throw std::runtime_error("Codec decode error, size mismatch");
+
+            size_t chunkSize = ReadBE32(header.chunk_size);
+            size_t nChunks = ReadBE32(header.n_chunks);
+            std::vector<size_t> offsets(nChunks + 1, PrefixSize(header));
+            for (size_t i = 0; i < nChunks; i++)
+                offsets[i + 1] = offsets[i] + ReadBE32(encoded + sizeof(CodecHeader) +
+                                                       i * sizeof(uint32_t));
+
+            ParallelFor(nChunks, threads,
+                        [&](size_t i)
+                        {
+                            size_t offset = i * chunkSize;
+                            DecodeChunk(encoded + offsets[i], offsets[i + 1] - offsets[i],
+                                        data + offset,
+                                        std::min(chunkSize, dataSize - offset),
+                                        elementSize, header.filters);
+                        });
+        }
+
+        /***
+         * Codec options matching encoded data, so that it can be re-encoded alike.
+         */
+        inline TensorCodec Options(const uint8_t *encoded)
+        {
+            CodecHeader header;
+            memcpy(&header, encoded, sizeof(header));
+            CheckFilters(header);
+            TensorCodec options;
+            options.shuffle = header.filters & FilterShuffle;
+            options.delta = header.filters & FilterDelta;
+            options.lz = header.filters & FilterLZ;
+            options.chunkSize = ReadBE32(header.chunk_size);
+            return options;
+        }
+    }
+}
+
+#endif // SHIVA_CODEC_HPP
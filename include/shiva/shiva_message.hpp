@@ -3,14 +3,17 @@
 
 #include <arpa/inet.h>
 #include <cstdint>
+#include <endian.h>
 #include <iostream>
 #include <netinet/tcp.h>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
 #include <typeindex>
 #include <unistd.h>
 #include <unordered_map>
 
+#include "shiva/shiva_codec.hpp"
 #include "shiva/utils.hpp"
 
 namespace shiva
@@ -29,6 +32,20 @@ namespace shiva
         uint32_t be_val_;
     } __attribute__((packed));
 
+    /**
+     * Bigendian uint64_t
+     */
+    class be_uint64_t
+    {
+    public:
+        be_uint64_t() : be_val_(0) {}
+        be_uint64_t(const uint64_t &val) : be_val_(htobe64(val)) {}
+        operator uint64_t() const { return be64toh(be_val_); }
+
+    private:
+        uint64_t be_val_;
+    } __attribute__((packed));
+
     inline std::unordered_map<std::type_index, int8_t> TensorTypeMap = {
         {typeid(float), 1},         // 32-bit floating point
         {typeid(uint8_t), 3},       // 8-bit unsigned integer
@@ -50,6 +67,36 @@ namespace shiva
         */
     };
 
+    /**
+     * Size in bytes of a single element of the given wire dtype, 0 if unknown.
+     */
+    inline size_t TensorDtypeSize(uint8_t dtype)
+    {
+        switch (dtype)
+        {
+        case 3:
+        case 4:
+            return 1;
+        case 5:
+        case 6:
+            return 2;
+        case 1:
+        case 7:
+        case 8:
+            return 4;
+        case 2:
+        case 9:
+        case 10:
+        case 11:
+        case 13:
+            return 8;
+        case 12:
+            return sizeof(long double);
+        default:
+            return 0;
+        }
+    }
+
     struct MessageHeader
     {
         uint8_t MAGIC[4];
@@ -99,6 +146,8 @@ namespace shiva
         std::vector<uint32_t> shape;
         std::type_index type;
         TensorHeader header;
+        TensorCodec codec;
+        size_t wireDataSize = 0; // data bytes of the last sent, serialized or received framing
 
         BaseTensor() : type(typeid(float)) {}
         virtual ~BaseTensor() = default;
@@ -108,6 +157,8 @@ namespace shiva
             TensorHeader header;
             header.rank = this->shape.size();
             header.dtype = TensorTypeMap[type];
+            if (this->codec.enabled())
+                header.dtype |= TensorCodecFlag;
             return header;
         }
 
@@ -132,8 +183,28 @@ namespace shiva
                                      "TensorShape");
         }
 
+        void serializeHeader(std::vector<uint8_t> &buffer)
+        {
+            TensorHeader header = this->buildHeader();
+            shiva::utils::BufferAppend(buffer, (const uint8_t *)&header,
+                                       sizeof(TensorHeader));
+        }
+
+        void serializeShape(std::vector<uint8_t> &buffer)
+        {
+            if (this->shape.size() == 0)
+                return;
+
+            std::vector<be_uint32_t> beshape =
+                std::vector<be_uint32_t>(this->shape.begin(), this->shape.end());
+            shiva::utils::BufferAppend(buffer, (const uint8_t *)&beshape[0],
+                                       sizeof(uint32_t) * beshape.size());
+        }
+
         virtual void sendData(int sock) = 0;
         virtual void receiveData(int sock) = 0;
+        virtual void serializeData(std::vector<uint8_t> &buffer) = 0;
+        virtual void deserializeData(const uint8_t *data, size_t size) = 0;
     };
     typedef std::shared_ptr<BaseTensor> BaseTensorPtr;
 
@@ -148,8 +219,22 @@ namespace shiva
 
         void sendData(int sock)
         {
+            this->wireDataSize = 0;
+            if (this->codec.enabled())
+            {
+                if (this->shape.size() == 0)
+                    return;
+
+                std::vector<uint8_t> encoded = this->encodeData();
+                this->wireDataSize = encoded.size();
+                shiva::utils::SocketSend(sock, encoded.data(), encoded.size(),
+                                         "TensorData");
+                return;
+            }
+
             if (this->data.size() == 0)
                 return;
+            this->wireDataSize = sizeof(T) * this->data.size();
 
             std::vector<T> beData = shiva::utils::ToBigEndian(this->data);
 
@@ -158,11 +243,63 @@ namespace shiva
                                      "TensorData");
         }
 
+        void serializeData(std::vector<uint8_t> &buffer)
+        {
+            this->wireDataSize = 0;
+            if (this->codec.enabled())
+            {
+                if (this->shape.size() == 0)
+                    return;
+
+                std::vector<uint8_t> encoded = this->encodeData();
+                this->wireDataSize = encoded.size();
+                shiva::utils::BufferAppend(buffer, encoded.data(), encoded.size());
+                return;
+            }
+
+            if (this->data.size() == 0)
+                return;
+            this->wireDataSize = sizeof(T) * this->data.size();
+
+            std::vector<T> beData = shiva::utils::ToBigEndian(this->data);
+            shiva::utils::BufferAppend(buffer, (const uint8_t *)&beData[0],
+                                       sizeof(T) * beData.size());
+        }
+
+        void deserializeData(const uint8_t *data, size_t size)
+        {
+            this->wireDataSize = size;
+            if (this->header.dtype & TensorCodecFlag)
+            {
+                if (this->shape.size() == 0)
+                    return;
+
+                std::vector<T> beData(this->elements());
+                shiva::codec::Decode(data, size, (uint8_t *)beData.data(),
+                                     beData.size() * sizeof(T), sizeof(T),
+                                     shiva::codec::DecodeThreads);
+                this->codec = shiva::codec::Options(data);
+                this->data = shiva::utils::FromBigEndian(beData);
+                return;
+            }
+
+            std::vector<T> beData(size / sizeof(T));
+            if (beData.size() > 0)
+                memcpy(&beData[0], data, beData.size() * sizeof(T));
+            this->data = shiva::utils::FromBigEndian(beData);
+        }
+
         void receiveData(int sock)
         {
             if (this->shape.size() == 0)
                 return;
 
+            if (this->header.dtype & TensorCodecFlag)
+            {
+                this->receiveEncodedData(sock);
+                return;
+            }
+
             int elements = 1;
             // expected size is product of all shape elements * sizeof(T)
             for (size_t i = 0; i < this->shape.size(); i++)
@@ -180,10 +317,56 @@ namespace shiva
 
             std::vector<T> beData = std::vector<T>(elements);
             std::copy_n(recv_data, elements, beData.begin());
+            this->wireDataSize = expected_size;
 
             this->data.clear();
             this->data = shiva::utils::FromBigEndian(beData);
         }
+
+    private:
+        size_t elements() const
+        {
+            size_t elements = 1;
+            for (size_t i = 0; i < this->shape.size(); i++)
+                elements *= this->shape[i];
+            return elements;
+        }
+
+        std::vector<uint8_t> encodeData()
+        {
+            if (this->data.size() != this->elements())
+                throw std::runtime_error("Tensor encode error, data does not match shape");
+
+            std::vector<T> beData = shiva::utils::ToBigEndian(this->data);
+            return shiva::codec::Encode((const uint8_t *)beData.data(),
+                                        beData.size() * sizeof(T), sizeof(T),
+                                        this->codec);
+        }
+
+        void receiveEncodedData(int sock)
+        {
+            // codec header and chunk sizes first, they tell the size of the chunks
+            std::vector<uint8_t> encoded(sizeof(shiva::codec::CodecHeader));
+            shiva::utils::SocketRecv(sock, encoded.data(), encoded.size(),
+                                     "CodecHeader");
+
+            // sizes come from the peer, check them before allocating anything
+            size_t dataSize = this->elements() * sizeof(T);
+            shiva::codec::CodecHeader codecHeader;
+            memcpy(&codecHeader, encoded.data(), sizeof(codecHeader));
+            shiva::codec::CheckHeader(codecHeader, dataSize, sizeof(T));
+            encoded.resize(shiva::codec::PrefixSize(codecHeader));
+            shiva::utils::SocketRecv(sock, encoded.data() + sizeof(codecHeader),
+                                     encoded.size() - sizeof(codecHeader),
+                                     "CodecChunkSizes");
+
+            size_t prefixSize = encoded.size();
+            encoded.resize(shiva::codec::CheckChunkSizes(encoded.data(), dataSize));
+            shiva::utils::SocketRecv(sock, encoded.data() + prefixSize,
+                                     encoded.size() - prefixSize, "TensorData");
+
+            this->deserializeData(encoded.data(), encoded.size());
+        }
     };
 
     class ShivaMessage
@@ -213,6 +396,63 @@ namespace shiva
             return *this;
         }
 
+        /**
+         * Create an empty tensor for the given wire dtype.
+         */
+        static BaseTensorPtr createTensor(uint8_t dtype)
+        {
+            BaseTensorPtr tensor;
+
+            switch (dtype)
+            {
+            case 1:
+                tensor = std::make_shared<Tensor<float>>();
+                break;
+            case 2: // this is here only for backwards compatibility, it is not used
+                tensor = std::make_shared<Tensor<double>>();
+                break;
+            case 3:
+                tensor = std::make_shared<Tensor<uint8_t>>();
+                break;
+            case 4:
+                tensor = std::make_shared<Tensor<int8_t>>();
+                break;
+            case 5:
+                tensor = std::make_shared<Tensor<uint16_t>>();
+                break;
+            case 6:
+                tensor = std::make_shared<Tensor<int16_t>>();
+                break;
+            case 7:
+                tensor = std::make_shared<Tensor<uint32_t>>();
+                break;
+            case 8:
+                tensor = std::make_shared<Tensor<int>>();
+                break;
+            case 9:
+                tensor = std::make_shared<Tensor<unsigned long>>();
+                break;
+            case 10:
+                tensor = std::make_shared<Tensor<long>>();
+                break;
+            case 11:
+                tensor = std::make_shared<Tensor<double>>();
+                break;
+            case 12:
+                tensor = std::make_shared<Tensor<long double>>();
+                break;
+            case 13:
+                tensor = std::make_shared<Tensor<long long>>();
+                break;
+            default:
+                throw std::runtime_error(
+                    "ShivaMessage createTensor error, not implemented dtype " +
+                    std::to_string(dtype));
+            }
+
+            return tensor;
+        }
+
         static ShivaMessage receive(int sock)
         {
             ShivaMessage returnMessage;
@@ -247,6 +487,31 @@ namespace shiva
             this->sendNamespace(sock);
         }
 
+        /**
+         * Serialize the message in the same wire framing written by sendMessage.
+         */
+        std::vector<uint8_t> serialize()
+        {
+            std::vector<uint8_t> buffer;
+            std::string mdata_str = this->metadata.dump();
+            MessageHeader header(mdata_str.size(), this->tensors.size(),
+                                 this->namespace_.size());
+            shiva::utils::BufferAppend(buffer, (const uint8_t *)&header,
+                                       sizeof(MessageHeader));
+            for (size_t i = 0; i < this->tensors.size(); i++)
+            {
+                this->tensors[i]->serializeHeader(buffer);
+                this->tensors[i]->serializeShape(buffer);
+                this->tensors[i]->serializeData(buffer);
+            }
+            shiva::utils::BufferAppend(buffer, (const uint8_t *)mdata_str.c_str(),
+                                       mdata_str.size());
+            shiva::utils::BufferAppend(buffer,
+                                       (const uint8_t *)this->namespace_.c_str(),
+                                       this->namespace_.size());
+            return buffer;
+        }
+
         nlohmann::json metadata;
         std::string namespace_;
         std::vector<std::shared_ptr<BaseTensor>> tensors;
@@ -281,55 +546,7 @@ namespace shiva
         BaseTensorPtr receiveTensor(int sock, const TensorHeader &th,
                                     const std::vector<uint32_t> &shape)
         {
-            BaseTensorPtr tensor;
-
-            switch (th.dtype)
-            {
-            case 1:
-                tensor = std::make_shared<Tensor<float>>();
-                break;
-            case 2: // this is here only for backwards compatibility, it is not used
-                tensor = std::make_shared<Tensor<double>>();
-                break;
-            case 3:
-                tensor = std::make_shared<Tensor<uint8_t>>();
-                break;
-            case 4:
-                tensor = std::make_shared<Tensor<int8_t>>();
-                break;
-            case 5:
-                tensor = std::make_shared<Tensor<uint16_t>>();
-                break;
-            case 6:
-                tensor = std::make_shared<Tensor<int16_t>>();
-                break;
-            case 7:
-                tensor = std::make_shared<Tensor<uint32_t>>();
-                break;
-            case 8:
-                tensor = std::make_shared<Tensor<int>>();
-                break;
-            case 9:
-                tensor = std::make_shared<Tensor<unsigned long>>();
-                break;
-            case 10:
-                tensor = std::make_shared<Tensor<long>>();
-                break;
-            case 11:
-                tensor = std::make_shared<Tensor<double>>();
-                break;
-            case 12:
-                tensor = std::make_shared<Tensor<long double>>();
-                break;
-            case 13:
-                tensor = std::make_shared<Tensor<long long>>();
-                break;
-            default:
-                throw std::runtime_error(
-                    "ShivaMessage receiveTensor error, not implemented dtype " +
-                    std::to_string(th.dtype));
-            }
-
+            BaseTensorPtr tensor = createTensor(th.dtype & ~TensorCodecFlag);
             tensor->header = th;
             tensor->shape = shape;
             tensor->receiveData(sock);
@@ -391,6 +608,160 @@ namespace shiva
             shiva::utils::SocketSend(sock, data, size, "Namespace");
         }
     };
+
+    /**
+     * Non owning view of a tensor laid out in wire framing. Data stays big endian (or
+     * encoded, see compressed()) and points into the viewed buffer, use at() to read
+     * converted elements.
+     */
+    struct TensorView
+    {
+        TensorHeader header;
+        std::vector<uint32_t> shape;
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+
+        size_t elements() const
+        {
+            size_t elements = shape.size() > 0 ? 1 : 0;
+            for (uint32_t n : shape)
+                elements *= n;
+            return elements;
+        }
+
+        /**
+         * Encoded tensor, data holds the codec payload and at() is not available.
+         */
+        bool compressed() const { return header.dtype & TensorCodecFlag; }
+
+        /**
+         * Checked element access, like std::vector::at: T must have the size of the
+         * tensor dtype and index must be within the data.
+         */
+        template <typename T> T at(size_t index) const
+        {
+            if (compressed())
+                throw std::runtime_error("TensorView at error, tensor is compressed");
+            if (sizeof(T) != TensorDtypeSize(header.dtype))
+                throw std::runtime_error("TensorView at error, type does not match dtype " +
+                                         std::to_string(header.dtype));
+            if (index >= size / sizeof(T))
+                throw std::out_of_range("TensorView at error, index " +
+                                        std::to_string(index) + " out of range");
+
+            T value;
+            memcpy(&value, data + index * sizeof(T), sizeof(T));
+            if (!shiva::utils::IsBigEndianMachine())
+                shiva::utils::ToggleEndiannessInPlace(&value, 1);
+            return value;
+        }
+    };
+
+    /**
+     * Non owning view of a message laid out in wire framing (e.g. a memory mapped
+     * capture). Parsing does not copy tensor data, metadata or namespace; the viewed
+     * buffer must outlive the view.
+     */
+    struct ShivaMessageView
+    {
+        MessageHeader header;
+        std::vector<TensorView> tensors;
+        std::string_view metadata;
+        std::string_view namespace_;
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+
+        static ShivaMessageView parse(const uint8_t *data, size_t size)
+        {
+            ShivaMessageView view;
+            view.data = data;
+            size_t offset = 0;
+
+            auto take = [&](size_t n, const char *what) -> const uint8_t *
+            {
+                if (n > size - offset)
+                    throw std::runtime_error(
+                        std::string("ShivaMessageView parse error, truncated ") + what);
+                const uint8_t *ptr = data + offset;
+                offset += n;
+                return ptr;
+            };
+
+            memcpy(&view.header, take(sizeof(MessageHeader), "MessageHeader"),
+                   sizeof(MessageHeader));
+
+            for (int i = 0; i < view.header.n_tensors; i++)
+            {
+                TensorView tensor;
+                memcpy(&tensor.header, take(sizeof(TensorHeader), "TensorHeader"),
+                       sizeof(TensorHeader));
+
+                size_t elementSize =
+                    TensorDtypeSize(tensor.header.dtype & ~TensorCodecFlag);
+                if (elementSize == 0)
+                    throw std::runtime_error(
+                        "ShivaMessageView parse error, not implemented dtype " +
+                        std::to_string(tensor.header.dtype));
+
+                const uint8_t *shape =
+                    take(sizeof(be_uint32_t) * tensor.header.rank, "TensorShape");
+                size_t elements = tensor.header.rank > 0 ? 1 : 0;
+                for (int r = 0; r < tensor.header.rank; r++)
+                {
+                    be_uint32_t dim;
+                    memcpy(&dim, shape + r * sizeof(be_uint32_t), sizeof(be_uint32_t));
+                    tensor.shape.push_back(dim);
+                    elements *= (uint32_t)dim;
+                }
+
+                tensor.size = elements * elementSize;
+                if (tensor.compressed() && tensor.header.rank > 0)
+                {
+                    // encoded data, its size is given by the codec prefix
+                    const uint8_t *prefix = data + offset;
+                    take(sizeof(codec::CodecHeader), "CodecHeader");
+                    codec::CodecHeader codecHeader;
+                    memcpy(&codecHeader, prefix, sizeof(codecHeader));
+                    take(codec::PrefixSize(codecHeader) - sizeof(codecHeader),
+                         "CodecChunkSizes");
+                    offset = prefix - data;
+                    tensor.size = codec::EncodedSize(prefix);
+                }
+                tensor.data = take(tensor.size, "TensorData");
+                view.tensors.push_back(tensor);
+            }
+
+            view.metadata = std::string_view(
+                (const char *)take(view.header.metadata_size, "Metadata"),
+                view.header.metadata_size);
+            view.namespace_ = std::string_view(
+                (const char *)take(view.header.trail_size, "Namespace"),
+                view.header.trail_size);
+            view.size = offset;
+            return view;
+        }
+
+        /**
+         * Copy the viewed data into an owning ShivaMessage.
+         */
+        ShivaMessage toMessage() const
+        {
+            ShivaMessage message;
+            for (const TensorView &view : this->tensors)
+            {
+                BaseTensorPtr tensor =
+                    ShivaMessage::createTensor(view.header.dtype & ~TensorCodecFlag);
+                tensor->header = view.header;
+                tensor->shape = view.shape;
+                tensor->deserializeData(view.data, view.size);
+                message.tensors.push_back(tensor);
+            }
+            if (this->metadata.size() > 0)
+                message.metadata = nlohmann::json::parse(this->metadata);
+            message.namespace_ = std::string(this->namespace_);
+            return message;
+        }
+    };
 }
 
 #endif // SHIVA_MESSAGE_HPP
@@ -0,0 +1,259 @@
+#ifndef SHIVA_MOCK_SERVER_HPP
+#define SHIVA_MOCK_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include "shiva/shiva_message.hpp"
+
+namespace shiva
+{
+    typedef std::function<ShivaMessage(const ShivaMessage &)> ShivaMockHandler;
+
+    struct ShivaMockServerOptions
+    {
+        unsigned short port = 0;          // 0 picks a free port
+        ShivaMockHandler handler = nullptr; // nullptr echoes messages
+        int delayMs = 0;                  // wait before sending each response
+        int writeChunkSize = 0;           // 0 sends the response in one write
+        int writeChunkDelayUs = 0;        // pause between two chunks
+        int readDelayMs = 0;              // wait before reading each message
+        int receiveBufferSize = 0;        // SO_RCVBUF, 0 keeps system default
+    };
+
+    /**
+     * In-process Shiva server, meant for tests and offline benchmarks.
+     *
+     * Every received message is passed to the handler and the returned message is
+     * sent back; without a handler the message is echoed. The server can also
+     * simulate a slow peer: a processing delay, responses written in small chunks
+     * and a reader that drains the socket late through a small receive buffer.
+     */
+    class ShivaMockServer
+    {
+    public:
+        typedef ShivaMockServerOptions Options;
+
+        ShivaMockServer(Options options = Options()) : options(options)
+        {
+            m_listenSock = -1;
+
+            if ((m_listenSock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+                throw std::runtime_error("ShivaMockServer socket creation failed");
+
+            int enable_reuse = 1;
+            if (setsockopt(m_listenSock, SOL_SOCKET, SO_REUSEADDR, &enable_reuse,
+                           sizeof(int)) < 0)
+                throw std::runtime_error("ShivaMockServer setsockopt SO_REUSEADDR failed");
+
+            struct sockaddr_in servAddr;
+            memset(&servAddr, 0, sizeof(servAddr));
+            servAddr.sin_family = AF_INET;
+            servAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            servAddr.sin_port = htons(options.port);
+
+            if (bind(m_listenSock, (struct sockaddr *)&servAddr, sizeof(servAddr)) < 0)
+                throw std::runtime_error("ShivaMockServer bind failed");
+
+            if (listen(m_listenSock, SOMAXCONN) < 0)
+                throw std::runtime_error("ShivaMockServer listen failed");
+
+            socklen_t len = sizeof(servAddr);
+            if (getsockname(m_listenSock, (struct sockaddr *)&servAddr, &len) < 0)
+                throw std::runtime_error("ShivaMockServer getsockname failed");
+            m_port = ntohs(servAddr.sin_port);
+
+            m_running = true;
+            m_acceptThread = std::thread(&ShivaMockServer::acceptLoop, this);
+        }
+
+        ShivaMockServer(const ShivaMockServer &) = delete;
+        ShivaMockServer &operator=(const ShivaMockServer &) = delete;
+
+        ~ShivaMockServer() { stop(); }
+
+        unsigned short port() const { return m_port; }
+
+        /**
+         * Number of messages answered since the server started.
+         */
+        uint64_t messageCount() const { return m_messageCount; }
+
+        /**
+         * Number of accepted connections still being served.
+         */
+        size_t connectionCount()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t count = 0;
+            for (auto &client : m_clients)
+                count += client.done ? 0 : 1;
+            return count;
+        }
+
+        /**
+         * Serve a connected socket in the calling thread until the peer closes it.
+         * Usable directly on one end of a socketpair, without any listening socket.
+         */
+        void serve(int sock)
+        {
+            if (options.receiveBufferSize > 0)
+                setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &options.receiveBufferSize,
+                           sizeof(int));
+
+            try
+            {
+                while (true)
+                {
+                    if (options.readDelayMs > 0)
+                        std::this_thread::sleep_for(
+                            std::chrono::milliseconds(options.readDelayMs));
+
+                    ShivaMessage request = ShivaMessage::receive(sock);
+                    ShivaMessage response =
+                        options.handler ? options.handler(request) : request;
+
+                    if (options.delayMs > 0)
+                        std::this_thread::sleep_for(
+                            std::chrono::milliseconds(options.delayMs));
+
+                    // counted first, so that it is up to date once the client has
+                    // the response
+                    m_messageCount++;
+                    this->sendResponse(sock, response);
+                }
+            }
+            catch (const std::exception &)
+            {
+                // peer disconnected or server stopped
+            }
+        }
+
+        void stop()
+        {
+            if (!m_running.exchange(false))
+                return;
+
+            // wake up the blocking accept and all blocking receives
+            ::shutdown(m_listenSock, SHUT_RDWR);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (auto &client : m_clients)
+                    if (!client.done)
+                        ::shutdown(client.sock, SHUT_RDWR);
+            }
+
+            if (m_acceptThread.joinable())
+                m_acceptThread.join();
+            // the accept thread is gone, nobody else touches the list anymore
+            for (auto &client : m_clients)
+                client.thread.join();
+            m_clients.clear();
+
+            ::close(m_listenSock);
+            m_listenSock = -1;
+        }
+
+        Options options;
+
+    private:
+        struct Client
+        {
+            int sock = -1;
+            std::thread thread;
+            bool done = false;
+        };
+
+        void acceptLoop()
+        {
+            while (m_running)
+            {
+                int sock = accept(m_listenSock, nullptr, nullptr);
+                if (sock < 0)
+                    break;
+
+                int enable_no_delay = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &enable_no_delay,
+                           sizeof(int));
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_running)
+                {
+                    ::close(sock);
+                    break;
+                }
+                this->reapClients();
+                m_clients.emplace_back();
+                Client *client = &m_clients.back();
+                client->sock = sock;
+                client->thread = std::thread(&ShivaMockServer::serveClient, this, client);
+            }
+        }
+
+        /**
+         * Serve an accepted connection and release its socket as soon as the peer
+         * is gone, the thread itself is joined later by reapClients or stop.
+         */
+        void serveClient(Client *client)
+        {
+            this->serve(client->sock);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ::close(client->sock);
+            client->sock = -1;
+            client->done = true;
+        }
+
+        /**
+         * Join the threads of finished connections, called with m_mutex held.
+         */
+        void reapClients()
+        {
+            for (auto it = m_clients.begin(); it != m_clients.end();)
+            {
+                if (!it->done)
+                {
+                    ++it;
+                    continue;
+                }
+                it->thread.join();
+                it = m_clients.erase(it);
+            }
+        }
+
+        void sendResponse(int sock, ShivaMessage &response)
+        {
+            if (options.writeChunkSize <= 0)
+            {
+                response.sendMessage(sock);
+                return;
+            }
+
+            std::vector<uint8_t> buffer = response.serialize();
+            for (size_t offset = 0; offset < buffer.size();
+                 offset += options.writeChunkSize)
+            {
+                int size = std::min((size_t)options.writeChunkSize,
+                                    buffer.size() - offset);
+                shiva::utils::SocketSend(sock, &buffer[offset], size, "Chunk");
+                if (options.writeChunkDelayUs > 0)
+                    std::this_thread::sleep_for(
+                        std::chrono::microseconds(options.writeChunkDelayUs));
+            }
+        }
+
+        int m_listenSock;
+        unsigned short m_port;
+        std::atomic<bool> m_running;
+        std::atomic<uint64_t> m_messageCount{0};
+        std::thread m_acceptThread;
+        std::mutex m_mutex;
+        std::list<Client> m_clients;
+    };
+}
+
+#endif // SHIVA_MOCK_SERVER_HPP
@@ -0,0 +1,77 @@
+#ifndef SHIVA_REPLAY_HPP
+#define SHIVA_REPLAY_HPP
+
+#include <functional>
+#include <thread>
+
+#include "shiva/shiva_capture.hpp"
+#include "shiva/shiva_client.hpp"
+
+namespace shiva
+{
+    struct ShivaReplayStats
+    {
+        uint64_t messages = 0;
+        uint64_t bytesSent = 0;
+        double seconds = 0;
+    };
+
+    /**
+     * Replay the sent messages of a capture against a server.
+     *
+     * Messages are written to the socket straight from the memory mapping, without
+     * being decoded. With speed > 0 the recorded inter-message timing is reproduced,
+     * scaled by speed (2 replays twice as fast); with speed == 0 messages are sent
+     * back to back, as fast as the server answers.
+     */
+    class ShivaReplayer
+    {
+    public:
+        typedef std::function<void(const CaptureRecord &, ShivaMessage &)> Callback;
+
+        ShivaReplayer(const ShivaCaptureReader &capture) : capture(capture) {}
+
+        ShivaReplayStats replay(ShivaClient &client, double speed = 1.0,
+                                Callback onResponse = nullptr)
+        {
+            typedef std::chrono::steady_clock Clock;
+
+            ShivaReplayStats stats;
+            Clock::time_point start = Clock::now();
+            uint64_t firstTimestamp = 0;
+            bool first = true;
+
+            for (const CaptureRecord &record : capture)
+            {
+                if (record.direction != CaptureDirection::Sent)
+                    continue;
+
+                if (first)
+                {
+                    firstTimestamp = record.timestampNs;
+                    first = false;
+                }
+                else if (speed > 0 && record.timestampNs > firstTimestamp)
+                {
+                    std::chrono::nanoseconds offset(
+                        (int64_t)((record.timestampNs - firstTimestamp) / speed));
+                    std::this_thread::sleep_until(start + offset);
+                }
+
+                ShivaMessage response = client.sendAndReceiveRaw(record.data, record.size);
+                if (onResponse)
+                    onResponse(record, response);
+
+                stats.messages++;
+                stats.bytesSent += record.size;
+            }
+
+            stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            return stats;
+        }
+
+        const ShivaCaptureReader &capture;
+    };
+}
+
+#endif // SHIVA_REPLAY_HPP
@@ -1,6 +1,8 @@
 #ifndef SHIVA_UTILS_HPP
 #define SHIVA_UTILS_HPP
 
+#include <algorithm>
+#include <cstdint>
 #include <errno.h>
 #include <sys/socket.h>
 #include <vector>
@@ -26,6 +28,10 @@ namespace shiva
         /***
          * Toggle the endianness of a value.
          *
+         * The toggled value is returned as a T, which does not preserve every byte
+         * pattern of every type (e.g. long double on x86), prefer
+         * ToggleEndiannessInPlace for data that is going to be sent or received.
+         *
          * @param value The value to toggle.
          * @return The value with the endianness toggled.
          */
@@ -43,6 +49,22 @@ namespace shiva
             return result;
         }
 
+        /***
+         * Toggle the endianness of an array of values, in place. Only the raw bytes
+         * are moved, values are never loaded as T in between.
+         *
+         * @param values The values to toggle.
+         * @param count The number of values.
+         */
+        template <typename T> inline void ToggleEndiannessInPlace(T *values, size_t count)
+        {
+            uint8_t *bytes = (uint8_t *)values;
+            for (size_t i = 0; i < count; i++)
+            {
+                std::reverse(bytes + i * sizeof(T), bytes + (i + 1) * sizeof(T));
+            }
+        }
+
         /***
          * Convert a vector of data to big endian, only if the machine is little endian.
          *
@@ -57,12 +79,8 @@ namespace shiva
                 return data;
             }
 
-            std::vector<T> result;
-            result.reserve(data.size());
-            for (auto it = data.begin(); it != data.end(); ++it)
-            {
-                result.emplace_back(ToggleEndianness(*it));
-            }
+            std::vector<T> result(data);
+            ToggleEndiannessInPlace(result.data(), result.size());
             return result;
         }
 
@@ -80,15 +98,24 @@ namespace shiva
                 return data;
             }
 
-            std::vector<T> result;
-            result.reserve(data.size());
-            for (auto it = data.begin(); it != data.end(); ++it)
-            {
-                result.emplace_back(ToggleEndianness(*it));
-            }
+            std::vector<T> result(data);
+            ToggleEndiannessInPlace(result.data(), result.size());
             return result;
         }
 
+        /***
+         * Append raw bytes at the end of a buffer.
+         *
+         * @param buffer The buffer to append the data to.
+         * @param data The data to append.
+         * @param size The size of the data to append.
+         */
+        inline void BufferAppend(std::vector<uint8_t> &buffer, const uint8_t *data,
+                                 size_t size)
+        {
+            buffer.insert(buffer.end(), data, data + size);
+        }
+
         /***
          * Receive data from a socket.
          *
@@ -134,7 +161,8 @@ namespace shiva
             while (sent_size < size)
             {
                 int remains = size - sent_size;
-                int chunk_size = send(sock, buffer + sent_size, remains, 0);
+                // MSG_NOSIGNAL: a closed peer is reported as an error, not SIGPIPE
+                int chunk_size = send(sock, buffer + sent_size, remains, MSG_NOSIGNAL);
                 if (chunk_size <= 0)
                 {
                     if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <new>
+#include <thread>
+
+#include "shiva/shiva_mock_server.hpp"
+#include "test_utils.hpp"
+
+/*
+Performance regression baselines, measured on a local socketpair with the mock echo
+server. Latencies are about 3x the medians measured on a developer machine in the
+default Release build (~40 us and ~8 ms), on an otherwise idle machine. Absolute
+timings depend on the build flags and on the load, so the latency tests are opt-in:
+they only run with SHIVA_PERF_TESTS=1, which the SHIVA_PERF_TESTS CMake option sets
+for a dedicated serial ctest entry labelled "perf". The allocation count is
+deterministic (115 at the time of writing, client and server side together) and is
+checked in every run. When an intended change moves them, update the constants
+together with the change.
+*/
+static constexpr double kMaxMedianRoundTripUs = 150;
+static constexpr double kMaxMedianLargeRoundTripUs = 25000;
+static constexpr uint64_t kMaxAllocationsPerRoundTrip = 140;
+
+static std::atomic<uint64_t> g_allocations(0);
+
+// the replacements below are a matching malloc/free pair, GCC can not see it
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void *operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return ::operator new(size); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { ::operator delete(ptr); }
+void operator delete[](void *ptr) noexcept { ::operator delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { ::operator delete(ptr); }
+
+using shiva_test::createMessage;
+using shiva_test::SocketPair;
+
+namespace
+{
+    /**
+     * Mock echo server serving one end of a socketpair from a background thread.
+     */
+    struct EchoPair
+    {
+        shiva::ShivaMockServer server;
+        SocketPair pair;
+        std::thread serving;
+
+        EchoPair()
+        {
+            serving = std::thread([this]() { server.serve(pair.fds[1]); });
+        }
+
+        ~EchoPair()
+        {
+            ::shutdown(pair.fds[0], SHUT_RDWR);
+            serving.join();
+        }
+
+        shiva::ShivaMessage roundTrip(shiva::ShivaMessage &message)
+        {
+            message.sendMessage(pair.fds[0]);
+            return shiva::ShivaMessage::receive(pair.fds[0]);
+        }
+    };
+
+    bool perfTestsEnabled()
+    {
+        const char *value = std::getenv("SHIVA_PERF_TESTS");
+        return value != nullptr && std::string(value) == "1";
+    }
+
+    double medianRoundTripUs(EchoPair &echo, shiva::ShivaMessage &message, int runs)
+    {
+        std::vector<double> latencies;
+        latencies.reserve(runs);
+        for (int i = 0; i < runs; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            echo.roundTrip(message);
+            auto stop = std::chrono::steady_clock::now();
+            latencies.push_back(
+                std::chrono::duration<double, std::micro>(stop - start).count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies[latencies.size() / 2];
+    }
+}
+
+TEST(PerformanceTest, SmallMessageRoundTripLatency)
+{
+    if (!perfTestsEnabled())
+        GTEST_SKIP() << "latency baselines only run with SHIVA_PERF_TESTS=1";
+
+    EchoPair echo;
+    shiva::ShivaMessage message = createMessage({16, 16});
+
+    // warmup
+    medianRoundTripUs(echo, message, 50);
+
+    double median = medianRoundTripUs(echo, message, 1000);
+    RecordProperty("median_us", std::to_string(median));
+    EXPECT_LT(median, kMaxMedianRoundTripUs);
+}
+
+TEST(PerformanceTest, LargeMessageRoundTripLatency)
+{
+    if (!perfTestsEnabled())
+        GTEST_SKIP() << "latency baselines only run with SHIVA_PERF_TESTS=1";
+
+    EchoPair echo;
+    shiva::ShivaMessage message = createMessage({640, 480, 3});
+
+    medianRoundTripUs(echo, message, 5);
+
+    double median = medianRoundTripUs(echo, message, 50);
+    RecordProperty("median_us", std::to_string(median));
+    EXPECT_LT(median, kMaxMedianLargeRoundTripUs);
+}
+
+TEST(PerformanceTest, AllocationsPerRoundTrip)
+{
+    EchoPair echo;
+    shiva::ShivaMessage message = createMessage({16, 16});
+    echo.roundTrip(message);
+
+    // counts both the client and the mock server side of the round trip
+    const int runs = 100;
+    uint64_t before = g_allocations.load();
+    for (int i = 0; i < runs; i++)
+        echo.roundTrip(message);
+    uint64_t perRoundTrip = (g_allocations.load() - before) / runs;
+
+    RecordProperty("allocations", std::to_string(perRoundTrip));
+    EXPECT_LE(perRoundTrip, kMaxAllocationsPerRoundTrip);
+}
@@ -0,0 +1,264 @@
+#include <cstdio>
+#include <dirent.h>
+#include <gtest/gtest.h>
+
+#include "shiva/shiva_mock_server.hpp"
+#include "shiva/shiva_replay.hpp"
+#include "test_utils.hpp"
+
+using shiva_test::createMessage;
+
+namespace
+{
+    class ShivaCaptureTest : public ::testing::Test
+    {
+    protected:
+        void SetUp() override
+        {
+            char name[] = "/tmp/shiva_capture_XXXXXX";
+            int fd = mkstemp(name);
+            ::close(fd);
+            path = name;
+            // the writer creates the file and its header
+            std::remove(path.c_str());
+        }
+
+        void TearDown() override
+        {
+            std::remove(path.c_str());
+            std::remove((path + ".idx").c_str());
+        }
+
+        /**
+         * Record count request/response pairs against an echo server.
+         */
+        void record(int count)
+        {
+            shiva::ShivaMockServer server;
+            shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+            client.startRecording(path);
+            for (int i = 0; i < count; i++)
+            {
+                shiva::ShivaMessage message = createMessage({32, 24, 3}, i);
+                client.sendAndReceiveMessage(message);
+            }
+            client.stopRecording();
+        }
+
+        std::string path;
+    };
+}
+
+TEST_F(ShivaCaptureTest, RecordAndRead)
+{
+    record(3);
+
+    shiva::ShivaCaptureReader capture(path);
+    ASSERT_EQ(capture.size(), 6u);
+
+    for (size_t i = 0; i < capture.size(); i++)
+    {
+        const shiva::CaptureRecord &record = capture[i];
+        EXPECT_EQ(record.direction, i % 2 == 0 ? shiva::CaptureDirection::Sent
+                                               : shiva::CaptureDirection::Received);
+        if (i > 0)
+        {
+            EXPECT_GE(record.timestampNs, capture[i - 1].timestampNs);
+        }
+
+        shiva::ShivaMessage expected = createMessage({32, 24, 3}, i / 2);
+        std::vector<uint8_t> bytes = expected.serialize();
+        ASSERT_EQ(record.size, bytes.size());
+        EXPECT_EQ(memcmp(record.data, bytes.data(), bytes.size()), 0);
+        EXPECT_EQ(record.message().serialize(), bytes);
+    }
+}
+
+TEST_F(ShivaCaptureTest, ZeroCopyView)
+{
+    record(1);
+
+    shiva::ShivaCaptureReader capture(path);
+    shiva::ShivaMessageView view = capture[0].view();
+
+    ASSERT_EQ(view.tensors.size(), 2u);
+    const shiva::TensorView &image = view.tensors[0];
+    EXPECT_EQ(image.shape, std::vector<uint32_t>({32, 24, 3}));
+    EXPECT_EQ(image.elements(), 32u * 24 * 3);
+    EXPECT_GT(image.data, capture[0].data);
+    EXPECT_LT(image.data, capture[0].data + capture[0].size);
+    EXPECT_EQ(image.data[5], (uint8_t)(5 * 7 + 3));
+
+    const shiva::TensorView &matrix = view.tensors[1];
+    EXPECT_EQ(matrix.header.dtype, 1);
+    EXPECT_EQ(matrix.at<float>(10), (float)(10 * 7 + 3));
+
+    // checked like std::vector::at, within the record and for the dtype size
+    EXPECT_THROW(matrix.at<float>(16), std::out_of_range);
+    EXPECT_THROW(matrix.at<double>(0), std::runtime_error);
+    EXPECT_THROW(image.at<uint16_t>(0), std::runtime_error);
+
+    EXPECT_EQ(nlohmann::json::parse(view.metadata)["counter"], 0);
+    EXPECT_EQ(view.namespace_, "inference");
+    EXPECT_EQ(view.size, capture[0].size);
+}
+
+TEST_F(ShivaCaptureTest, AppendAcrossSessions)
+{
+    record(2);
+    record(1);
+
+    shiva::ShivaCaptureReader capture(path);
+    EXPECT_EQ(capture.size(), 6u);
+}
+
+TEST_F(ShivaCaptureTest, RebuildMissingIndex)
+{
+    record(2);
+    std::remove((path + ".idx").c_str());
+
+    shiva::ShivaCaptureReader capture(path);
+    ASSERT_EQ(capture.size(), 4u);
+    EXPECT_EQ(capture[2].message().metadata["counter"], 1);
+}
+
+TEST_F(ShivaCaptureTest, StaleIndexAndTruncatedRecord)
+{
+    record(2);
+
+    // drop the last index entry and cut the last record in half
+    FILE *index = fopen((path + ".idx").c_str(), "r+b");
+    fseek(index, 0, SEEK_END);
+    ASSERT_EQ(ftruncate(fileno(index), ftell(index) - sizeof(shiva::CaptureIndexEntry)),
+              0);
+    fclose(index);
+
+    FILE *file = fopen(path.c_str(), "r+b");
+    fseek(file, 0, SEEK_END);
+    ASSERT_EQ(ftruncate(fileno(file), ftell(file) - 10), 0);
+    fclose(file);
+
+    shiva::ShivaCaptureReader capture(path);
+    EXPECT_EQ(capture.size(), 3u);
+}
+
+TEST_F(ShivaCaptureTest, InvalidCaptureThrows)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    fputs("not a capture file at all", file);
+    fclose(file);
+
+    EXPECT_THROW(shiva::ShivaCaptureReader capture(path), std::runtime_error);
+}
+
+TEST_F(ShivaCaptureTest, AppendRefusesInvalidCapture)
+{
+    const std::string content = "not a capture file at all";
+    FILE *file = fopen(path.c_str(), "wb");
+    fputs(content.c_str(), file);
+    fclose(file);
+
+    EXPECT_THROW(shiva::ShivaCaptureWriter writer(path), std::runtime_error);
+
+    // the file is left untouched
+    char buffer[64] = {};
+    file = fopen(path.c_str(), "rb");
+    size_t read = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+    EXPECT_EQ(std::string(buffer, read), content);
+}
+
+TEST_F(ShivaCaptureTest, UnwritableIndexReleasesCapture)
+{
+    auto openFileDescriptors = []()
+    {
+        int count = 0;
+        DIR *dir = opendir("/proc/self/fd");
+        while (dir != nullptr && readdir(dir) != nullptr)
+            count++;
+        if (dir != nullptr)
+            closedir(dir);
+        return count;
+    };
+
+    // a directory in place of the index can not be opened for writing
+    ASSERT_EQ(mkdir((path + ".idx").c_str(), 0700), 0);
+    int before = openFileDescriptors();
+    EXPECT_THROW(shiva::ShivaCaptureWriter writer(path), std::runtime_error);
+    EXPECT_EQ(openFileDescriptors(), before);
+    rmdir((path + ".idx").c_str());
+}
+
+TEST_F(ShivaCaptureTest, AppendAfterTruncatedRecord)
+{
+    record(2);
+
+    // simulate a crash while writing the last record
+    FILE *file = fopen(path.c_str(), "r+b");
+    fseek(file, 0, SEEK_END);
+    ASSERT_EQ(ftruncate(fileno(file), ftell(file) - 10), 0);
+    fclose(file);
+
+    record(1);
+
+    // the partial record is dropped and the index matches the capture again
+    shiva::ShivaCaptureReader capture(path);
+    ASSERT_EQ(capture.size(), 5u);
+    EXPECT_EQ(capture[3].direction, shiva::CaptureDirection::Sent);
+    EXPECT_EQ(capture[3].message().metadata["counter"], 0);
+    EXPECT_EQ(capture[4].direction, shiva::CaptureDirection::Received);
+
+    struct stat st;
+    ASSERT_EQ(stat((path + ".idx").c_str(), &st), 0);
+    EXPECT_EQ((size_t)st.st_size,
+              sizeof(shiva::CaptureFileHeader) + 5 * sizeof(shiva::CaptureIndexEntry));
+}
+
+TEST_F(ShivaCaptureTest, ReplayMaxSpeed)
+{
+    record(5);
+    shiva::ShivaCaptureReader capture(path);
+
+    shiva::ShivaMockServer server;
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+    shiva::ShivaReplayer replayer(capture);
+
+    int counter = 0;
+    shiva::ShivaReplayStats stats = replayer.replay(
+        client, 0,
+        [&](const shiva::CaptureRecord &record, shiva::ShivaMessage &response)
+        {
+            EXPECT_EQ(record.direction, shiva::CaptureDirection::Sent);
+            EXPECT_EQ(response.metadata["counter"], counter++);
+        });
+
+    EXPECT_EQ(stats.messages, 5u);
+    EXPECT_EQ(server.messageCount(), 5u);
+}
+
+TEST_F(ShivaCaptureTest, ReplayRecordedSpeed)
+{
+    {
+        shiva::ShivaMockServer server;
+        shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+        client.startRecording(path);
+        for (int i = 0; i < 3; i++)
+        {
+            shiva::ShivaMessage message = createMessage({32, 24, 3}, i);
+            client.sendAndReceiveMessage(message);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    shiva::ShivaCaptureReader capture(path);
+    shiva::ShivaMockServer server;
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+    shiva::ShivaReplayer replayer(capture);
+
+    shiva::ShivaReplayStats stats = replayer.replay(client, 1.0);
+    EXPECT_EQ(stats.messages, 3u);
+    EXPECT_GE(stats.seconds, 0.1);
+
+    stats = replayer.replay(client, 0);
+    EXPECT_LT(stats.seconds, 0.1);
+}
@@ -0,0 +1,425 @@
+#include <atomic>
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+#include "shiva/shiva_client.hpp"
+#include "shiva/shiva_mock_server.hpp"
+#include "test_utils.hpp"
+
+using shiva_test::createTensor;
+using shiva_test::roundTrip;
+
+namespace
+{
+    std::vector<uint8_t> randomBytes(size_t size, unsigned int seed)
+    {
+        std::mt19937 generator(seed);
+        std::vector<uint8_t> data(size);
+        for (auto &byte : data)
+            byte = generator();
+        return data;
+    }
+
+    /**
+     * Smooth synthetic depth map, with a little noise like a real sensor.
+     */
+    shiva::Tensor<uint16_t>::Ptr createDepth(uint32_t rows, uint32_t cols)
+    {
+        std::mt19937 generator(42);
+        auto tensor = std::make_shared<shiva::Tensor<uint16_t>>();
+        tensor->shape = {rows, cols};
+        for (uint32_t r = 0; r < rows; r++)
+            for (uint32_t c = 0; c < cols; c++)
+                tensor->data.push_back(1000 + r * 2 + c / 4 + generator() % 3);
+        return tensor;
+    }
+
+    shiva::TensorCodec allStages(uint32_t chunkSize = 1 << 20)
+    {
+        shiva::TensorCodec codec;
+        codec.shuffle = true;
+        codec.delta = true;
+        codec.lz = true;
+        codec.chunkSize = chunkSize;
+        return codec;
+    }
+}
+
+TEST(CodecTest, LZRoundTrip)
+{
+    std::vector<std::vector<uint8_t>> inputs = {
+        {},
+        {1},
+        {1, 2, 3},
+        std::vector<uint8_t>(100000, 7),
+        randomBytes(70000, 1),
+    };
+
+    // repetitive text with long matches and long literal runs
+    std::string text;
+    for (int i = 0; i < 2000; i++)
+        text += "frame " + std::to_string(i % 37) + " of the inference pipeline; ";
+    inputs.push_back(std::vector<uint8_t>(text.begin(), text.end()));
+
+    for (auto &input : inputs)
+    {
+        std::vector<uint8_t> compressed =
+            shiva::codec::LZCompress(input.data(), input.size());
+        EXPECT_LE(compressed.size(), shiva::codec::LZBound(input.size()));
+
+        std::vector<uint8_t> output(input.size());
+        shiva::codec::LZDecompress(compressed.data(), compressed.size(), output.data(),
+                                   output.size());
+        EXPECT_EQ(output, input);
+    }
+}
+
+TEST(CodecTest, LZCompressesRedundantData)
+{
+    std::vector<uint8_t> input(1 << 20, 0);
+    std::vector<uint8_t> compressed = shiva::codec::LZCompress(input.data(), input.size());
+    EXPECT_LT(compressed.size(), input.size() / 100);
+}
+
+TEST(CodecTest, LZRejectsCorruptedData)
+{
+    std::vector<uint8_t> input(10000, 3);
+    std::vector<uint8_t> compressed = shiva::codec::LZCompress(input.data(), input.size());
+    std::vector<uint8_t> output(input.size());
+
+    EXPECT_THROW(shiva::codec::LZDecompress(compressed.data(), compressed.size(),
+                                            output.data(), output.size() - 1),
+                 std::runtime_error);
+    EXPECT_THROW(shiva::codec::LZDecompress(compressed.data(), compressed.size() / 2,
+                                            output.data(), output.size()),
+                 std::runtime_error);
+
+    // a match pointing before the start of the output
+    std::vector<uint8_t> invalid = {0x10, 'a', 0x10, 0x00};
+    EXPECT_THROW(shiva::codec::LZDecompress(invalid.data(), invalid.size(),
+                                            output.data(), 5),
+                 std::runtime_error);
+}
+
+TEST(CodecTest, FiltersRoundTrip)
+{
+    std::vector<uint8_t> input = randomBytes(4096 * 8, 2);
+    for (size_t elementSize : {1, 2, 4, 8})
+    {
+        std::vector<uint8_t> shuffled(input.size());
+        std::vector<uint8_t> output(input.size());
+        shiva::codec::Shuffle(input.data(), shuffled.data(), input.size(), elementSize);
+        EXPECT_EQ(shuffled[1], input[elementSize]);
+
+        size_t planeSize = input.size() / elementSize;
+        shiva::codec::DeltaEncode(shuffled.data(), shuffled.size(), planeSize);
+        shiva::codec::DeltaDecode(shuffled.data(), shuffled.size(), planeSize);
+        shiva::codec::Unshuffle(shuffled.data(), output.data(), input.size(),
+                                elementSize);
+        EXPECT_EQ(output, input);
+    }
+}
+
+TEST(CodecTest, ChunkedParallelRoundTrip)
+{
+    std::vector<uint8_t> input = randomBytes(1000 * 4 + 12, 3);
+    // make the second half compressible, the first half is stored as is
+    std::fill(input.begin() + input.size() / 2, input.end(), 9);
+
+    for (unsigned int threads : {1u, 4u})
+    {
+        shiva::TensorCodec codec = allStages(1001);
+        codec.threads = threads;
+        std::vector<uint8_t> encoded =
+            shiva::codec::Encode(input.data(), input.size(), 4, codec);
+        EXPECT_EQ(shiva::codec::EncodedSize(encoded.data()), encoded.size());
+
+        std::vector<uint8_t> output(input.size());
+        shiva::codec::Decode(encoded.data(), encoded.size(), output.data(),
+                             output.size(), 4, threads);
+        EXPECT_EQ(output, input);
+    }
+}
+
+TEST(CodecTest, WorkerPoolReusesThreads)
+{
+    shiva::codec::WorkerPool pool;
+    std::vector<std::thread> callers;
+    std::atomic<size_t> sum(0);
+
+    // concurrent callers share the same workers
+    for (int c = 0; c < 3; c++)
+        callers.emplace_back(
+            [&]()
+            {
+                for (int run = 0; run < 50; run++)
+                    pool.run(100, 4, [&](size_t i) { sum += i; });
+            });
+    for (auto &caller : callers)
+        caller.join();
+
+    EXPECT_EQ(sum, 3u * 50u * (99u * 100u / 2));
+    EXPECT_EQ(pool.size(), 3u);
+}
+
+TEST(CodecTest, WorkerPoolThreadCount)
+{
+    shiva::codec::WorkerPool pool;
+    std::atomic<size_t> count(0);
+
+    // 0 uses all cores, never more threads than jobs
+    pool.run(2, 0, [&](size_t) { count++; });
+    EXPECT_EQ(count, 2u);
+    EXPECT_LE(pool.size(), 1u);
+
+    pool.run(0, 0, [&](size_t) { count++; });
+    pool.run(5, 1, [&](size_t) { count++; });
+    EXPECT_EQ(count, 7u);
+    EXPECT_LE(pool.size(), 1u);
+}
+
+TEST(CodecTest, WorkerPoolRethrows)
+{
+    shiva::codec::WorkerPool pool;
+    EXPECT_THROW(pool.run(100, 4,
+                          [](size_t i)
+                          {
+                              if (i == 42)
+                                  throw std::runtime_error("job failed");
+                          }),
+                 std::runtime_error);
+
+    // the pool is still usable afterwards
+    std::atomic<size_t> count(0);
+    pool.run(10, 4, [&](size_t) { count++; });
+    EXPECT_EQ(count, 10u);
+}
+
+TEST(CodecTest, DecodeRejectsMismatchedSize)
+{
+    std::vector<uint8_t> input(4096, 1);
+    std::vector<uint8_t> encoded =
+        shiva::codec::Encode(input.data(), input.size(), 2, allStages(1024));
+    std::vector<uint8_t> output(input.size() * 2);
+
+    EXPECT_THROW(shiva::codec::Decode(encoded.data(), encoded.size(), output.data(),
+                                      output.size(), 2),
+                 std::runtime_error);
+    EXPECT_THROW(shiva::codec::Decode(encoded.data(), encoded.size() - 1, output.data(),
+                                      input.size(), 2),
+                 std::runtime_error);
+}
+
+TEST(CodecTest, DecodeRejectsUnsupportedFilters)
+{
+    std::vector<uint8_t> input(4096, 1);
+    std::vector<uint8_t> encoded =
+        shiva::codec::Encode(input.data(), input.size(), 2, allStages(1024));
+    std::vector<uint8_t> output(input.size());
+
+    std::vector<uint8_t> futureFilter = encoded;
+    futureFilter[offsetof(shiva::codec::CodecHeader, filters)] |= 1 << 3;
+    std::vector<uint8_t> reserved = encoded;
+    reserved[offsetof(shiva::codec::CodecHeader, reserved)] = 1;
+
+    for (auto &corrupted : {futureFilter, reserved})
+    {
+        try
+        {
+            shiva::codec::Decode(corrupted.data(), corrupted.size(), output.data(),
+                                 output.size(), 2);
+            ADD_FAILURE() << "unsupported filters decoded";
+        }
+        catch (const std::runtime_error &error)
+        {
+            EXPECT_STREQ(error.what(), "Codec decode error, unsupported filters");
+        }
+        EXPECT_THROW(shiva::codec::Options(corrupted.data()), std::runtime_error);
+    }
+}
+
+template <typename T> class TensorCodecTypedTest : public ::testing::Test
+{
+};
+
+typedef ::testing::Types<float, double, uint8_t, int8_t, uint16_t, int16_t, uint32_t,
+                         int, unsigned long, long, long double, long long>
+    CodecTensorTypes;
+TYPED_TEST_SUITE(TensorCodecTypedTest, CodecTensorTypes);
+
+TYPED_TEST(TensorCodecTypedTest, RoundTrip)
+{
+    for (uint8_t stages = 1; stages < 8; stages++)
+    {
+        shiva::ShivaMessage message;
+        auto tensor = createTensor<TypeParam>({3, 50, 41});
+        tensor->codec.shuffle = stages & 1;
+        tensor->codec.delta = stages & 2;
+        tensor->codec.lz = stages & 4;
+        tensor->codec.chunkSize = 1000;
+        message.tensors.push_back(tensor);
+        message.tensors.push_back(createTensor<TypeParam>({7}));
+        message.metadata = {{"stages", stages}};
+
+        shiva::ShivaMessage received = roundTrip(message);
+
+        ASSERT_EQ(received.tensors.size(), 2u);
+        auto decoded =
+            std::dynamic_pointer_cast<shiva::Tensor<TypeParam>>(received.tensors[0]);
+        ASSERT_NE(decoded, nullptr);
+        EXPECT_EQ(decoded->shape, tensor->shape);
+        EXPECT_EQ(decoded->data, tensor->data);
+        EXPECT_EQ(decoded->codec.shuffle, tensor->codec.shuffle);
+        EXPECT_EQ(decoded->codec.lz, tensor->codec.lz);
+        EXPECT_FALSE(received.tensors[1]->codec.enabled());
+        EXPECT_EQ(received.metadata, message.metadata);
+
+        // the serialized framing is the one sent on the socket
+        std::vector<uint8_t> bytes = message.serialize();
+        shiva::ShivaMessage parsed =
+            shiva::ShivaMessageView::parse(bytes.data(), bytes.size()).toMessage();
+        EXPECT_EQ(std::dynamic_pointer_cast<shiva::Tensor<TypeParam>>(parsed.tensors[0])
+                      ->data,
+                  tensor->data);
+    }
+}
+
+TEST(TensorCodecTest, FlagRejectedByLegacyDtypes)
+{
+    shiva::ShivaMessage message;
+    auto tensor = createTensor<uint8_t>({4, 4});
+    tensor->codec.lz = true;
+    message.tensors.push_back(tensor);
+
+    std::vector<uint8_t> bytes = message.serialize();
+    uint8_t dtype = bytes[sizeof(shiva::MessageHeader) + 1];
+    EXPECT_EQ(dtype, 3 | shiva::TensorCodecFlag);
+
+    // a peer without codec support looks the raw dtype up and fails
+    EXPECT_EQ(shiva::TensorDtypeSize(dtype), 0u);
+    EXPECT_THROW(shiva::ShivaMessage::createTensor(dtype), std::runtime_error);
+}
+
+TEST(TensorCodecTest, CompressesImagesAndDepth)
+{
+    auto depth = createDepth(480, 640);
+    auto image = std::make_shared<shiva::Tensor<uint8_t>>();
+    image->shape = {480, 640, 3};
+    for (uint32_t i = 0; i < 480 * 640; i++)
+        for (int c = 0; c < 3; c++)
+            image->data.push_back((i % 640) / 3 + c * 20);
+
+    shiva::ShivaMessage raw;
+    raw.tensors = {depth, image};
+    size_t rawSize = raw.serialize().size();
+
+    depth->codec = allStages();
+    image->codec.delta = true;
+    image->codec.lz = true;
+    shiva::ShivaMessage compressed;
+    compressed.tensors = {depth, image};
+    size_t compressedSize = compressed.serialize().size();
+
+    EXPECT_LT(compressedSize, rawSize / 4);
+}
+
+TEST(TensorCodecTest, ViewOfCompressedTensor)
+{
+    shiva::ShivaMessage message;
+    auto depth = createDepth(20, 30);
+    depth->codec = allStages(256);
+    message.tensors.push_back(depth);
+    message.namespace_ = "depth";
+
+    std::vector<uint8_t> bytes = message.serialize();
+    shiva::ShivaMessageView view = shiva::ShivaMessageView::parse(bytes.data(), bytes.size());
+
+    ASSERT_EQ(view.tensors.size(), 1u);
+    EXPECT_TRUE(view.tensors[0].compressed());
+    EXPECT_EQ(view.tensors[0].elements(), 600u);
+    EXPECT_THROW(view.tensors[0].at<uint16_t>(0), std::runtime_error);
+    EXPECT_EQ(view.namespace_, "depth");
+    EXPECT_EQ(view.size, bytes.size());
+
+    shiva::ShivaMessage decoded = view.toMessage();
+    EXPECT_EQ(std::dynamic_pointer_cast<shiva::Tensor<uint16_t>>(decoded.tensors[0])->data,
+              depth->data);
+}
+
+TEST(TensorCodecTest, EchoKeepsCodec)
+{
+    shiva::ShivaMockServer server;
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+
+    shiva::ShivaMessage message;
+    auto depth = createDepth(120, 160);
+    depth->codec = allStages(8192);
+    message.tensors.push_back(depth);
+
+    shiva::ShivaMessage response = client.sendAndReceiveMessage(message);
+    EXPECT_EQ(response.serialize(), message.serialize());
+}
+
+TEST(TensorCodecTest, DecodeThreadsSetting)
+{
+    shiva::ShivaMessage message;
+    auto depth = createDepth(60, 80);
+    depth->codec = allStages(512);
+    message.tensors.push_back(depth);
+
+    for (unsigned int threads : {1u, 3u, 0u})
+    {
+        shiva::codec::DecodeThreads = threads;
+        shiva::ShivaMessage received = roundTrip(message);
+        EXPECT_EQ(std::dynamic_pointer_cast<shiva::Tensor<uint16_t>>(received.tensors[0])
+                      ->data,
+                  depth->data);
+    }
+}
+
+TEST(TensorCodecTest, WireDataSize)
+{
+    shiva::ShivaMessage message;
+    auto depth = createDepth(60, 80);
+    depth->codec = allStages(1024);
+    auto raw = createTensor<float>({5, 5});
+    message.tensors = {depth, raw};
+
+    shiva::ShivaMessage received = roundTrip(message);
+
+    EXPECT_GT(depth->wireDataSize, 0u);
+    EXPECT_LT(depth->wireDataSize, depth->data.size() * sizeof(uint16_t));
+    EXPECT_EQ(raw->wireDataSize, 25 * sizeof(float));
+    EXPECT_EQ(received.tensors[0]->wireDataSize, depth->wireDataSize);
+    EXPECT_EQ(received.tensors[1]->wireDataSize, raw->wireDataSize);
+}
+
+TEST(TensorCodecTest, ReceiveRejectsInvalidSizes)
+{
+    shiva::ShivaMessage message;
+    auto tensor = createTensor<uint8_t>({4});
+    tensor->codec.lz = true;
+    message.tensors.push_back(tensor);
+    std::vector<uint8_t> bytes = message.serialize();
+
+    // MessageHeader, TensorHeader, one be_uint32_t of shape, then the CodecHeader
+    size_t codecOffset = sizeof(shiva::MessageHeader) + sizeof(shiva::TensorHeader) + 4;
+    size_t nChunksOffset = codecOffset + offsetof(shiva::codec::CodecHeader, n_chunks);
+    size_t chunkSizesOffset = codecOffset + sizeof(shiva::codec::CodecHeader);
+
+    std::vector<uint8_t> hugeChunkCount = bytes;
+    shiva::codec::WriteBE32(&hugeChunkCount[nChunksOffset], 1u << 30);
+    std::vector<uint8_t> hugeChunk = bytes;
+    shiva::codec::WriteBE32(&hugeChunk[chunkSizesOffset], 1u << 30);
+
+    for (auto &corrupted : {hugeChunkCount, hugeChunk})
+    {
+        shiva_test::SocketPair pair;
+        shiva::utils::SocketSend(pair.fds[0], corrupted.data(), corrupted.size(),
+                                 "Message");
+        ::shutdown(pair.fds[0], SHUT_WR);
+        // rejected from the header, before allocating the claimed sizes
+        EXPECT_THROW(shiva::ShivaMessage::receive(pair.fds[1]), std::runtime_error);
+    }
+}
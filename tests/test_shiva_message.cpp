@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "test_utils.hpp"
+
+using shiva_test::createTensor;
+using shiva_test::roundTrip;
+using shiva_test::SocketPair;
+
+template <typename T> class TensorFramingTest : public ::testing::Test
+{
+};
+
+typedef ::testing::Types<float, double, uint8_t, int8_t, uint16_t, int16_t, uint32_t,
+                         int, unsigned long, long, long double, long long>
+    TensorTypes;
+TYPED_TEST_SUITE(TensorFramingTest, TensorTypes);
+
+TYPED_TEST(TensorFramingTest, RoundTrip)
+{
+    shiva::ShivaMessage message;
+    message.tensors.push_back(createTensor<TypeParam>({3, 50, 41}));
+    message.tensors.push_back(createTensor<TypeParam>({1}));
+    message.metadata = {{"counter", 42}, {"__tensors__", {"a", "b"}}};
+    message.namespace_ = "inference";
+
+    shiva::ShivaMessage received = roundTrip(message);
+
+    ASSERT_EQ(received.tensors.size(), 2u);
+    for (size_t i = 0; i < received.tensors.size(); i++)
+    {
+        auto expected = std::dynamic_pointer_cast<shiva::Tensor<TypeParam>>(
+            message.tensors[i]);
+        auto tensor = std::dynamic_pointer_cast<shiva::Tensor<TypeParam>>(
+            received.tensors[i]);
+        ASSERT_NE(tensor, nullptr);
+        EXPECT_EQ(tensor->shape, expected->shape);
+        EXPECT_EQ(tensor->header.rank, expected->shape.size());
+        EXPECT_EQ(tensor->header.dtype, shiva::TensorTypeMap[typeid(TypeParam)]);
+        EXPECT_EQ(tensor->data, expected->data);
+    }
+    EXPECT_EQ(received.metadata, message.metadata);
+    EXPECT_EQ(received.namespace_, message.namespace_);
+}
+
+TYPED_TEST(TensorFramingTest, SerializeMatchesSocketFraming)
+{
+    shiva::ShivaMessage message;
+    message.tensors.push_back(createTensor<TypeParam>({4, 5}));
+    message.metadata = {{"key", "value"}};
+    message.namespace_ = "ns";
+
+    SocketPair pair;
+    message.sendMessage(pair.fds[0]);
+    std::vector<uint8_t> expected = message.serialize();
+    std::vector<uint8_t> sent(expected.size());
+    shiva::utils::SocketRecv(pair.fds[1], sent.data(), sent.size(), "Message");
+
+    EXPECT_EQ(sent, expected);
+}
+
+TEST(ShivaMessageTest, EmptyMessage)
+{
+    shiva::ShivaMessage message;
+    shiva::ShivaMessage received = roundTrip(message);
+
+    EXPECT_TRUE(received.tensors.empty());
+    EXPECT_EQ(received.metadata, nlohmann::json::object());
+    EXPECT_EQ(received.namespace_, "");
+}
+
+TEST(ShivaMessageTest, HeaderLayout)
+{
+    shiva::ShivaMessage message;
+    message.tensors.push_back(createTensor<uint8_t>({2, 2}));
+    message.metadata = {{"a", 1}};
+    message.namespace_ = "abc";
+
+    std::vector<uint8_t> bytes = message.serialize();
+    ASSERT_GE(bytes.size(), sizeof(shiva::MessageHeader));
+    EXPECT_EQ(sizeof(shiva::MessageHeader), 12u);
+    EXPECT_EQ(sizeof(shiva::TensorHeader), 2u);
+
+    // magic, big endian metadata size, n_tensors, trail size
+    std::vector<uint8_t> expected = {6, 66, 11, 1, 0, 0, 0, 7, 1, 3};
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), bytes.begin()));
+    uint8_t crc = (6 + 66 + 11 + 1 + 7 + 1 + 3) % 256;
+    EXPECT_EQ(bytes[10], crc);
+    EXPECT_EQ(bytes[11], (uint8_t)((crc + crc) % 256));
+
+    // tensor header, shape and data follow the message header
+    EXPECT_EQ(bytes[12], 2);
+    EXPECT_EQ(bytes[13], 3);
+    EXPECT_EQ(bytes.size(), 12u + 2 + 8 + 4 + 7 + 3);
+}
+
+TEST(ShivaMessageTest, BigEndianData)
+{
+    shiva::ShivaMessage message;
+    auto tensor = std::make_shared<shiva::Tensor<uint32_t>>();
+    tensor->data = {0x01020304};
+    tensor->shape = {1};
+    message.tensors.push_back(tensor);
+
+    std::vector<uint8_t> bytes = message.serialize();
+    std::vector<uint8_t> expected = {0, 0, 0, 1, 1, 2, 3, 4};
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), bytes.begin() + 14));
+}
+
+TEST(ShivaMessageTest, LongDoubleValues)
+{
+    // values whose 80 bit representation used to be corrupted by the byte swap
+    shiva::ShivaMessage message;
+    auto tensor = std::make_shared<shiva::Tensor<long double>>();
+    tensor->data = {0.1L, 1.0L / 3.0L, -2.5e-300L, 1e300L};
+    tensor->shape = {4};
+    message.tensors.push_back(tensor);
+
+    shiva::ShivaMessage received = roundTrip(message);
+    auto decoded =
+        std::dynamic_pointer_cast<shiva::Tensor<long double>>(received.tensors[0]);
+    ASSERT_NE(decoded, nullptr);
+    EXPECT_EQ(decoded->data, tensor->data);
+}
+
+TEST(ShivaMessageTest, LegacyDoubleDtype)
+{
+    // dtype 2 is still accepted on receive as a 64-bit float
+    shiva::ShivaMessage message;
+    auto tensor = std::make_shared<shiva::Tensor<double>>();
+    tensor->data = {1.5, -0.25, 1e100};
+    tensor->shape = {3};
+    message.tensors.push_back(tensor);
+
+    std::vector<uint8_t> bytes = message.serialize();
+    ASSERT_EQ(bytes[13], 11);
+    bytes[13] = 2;
+
+    SocketPair pair;
+    shiva::utils::SocketSend(pair.fds[0], bytes.data(), bytes.size(), "Message");
+    shiva::ShivaMessage received = shiva::ShivaMessage::receive(pair.fds[1]);
+
+    auto decoded = std::dynamic_pointer_cast<shiva::Tensor<double>>(received.tensors[0]);
+    ASSERT_NE(decoded, nullptr);
+    EXPECT_EQ(decoded->header.dtype, 2);
+    EXPECT_EQ(decoded->data, tensor->data);
+}
+
+TEST(ShivaMessageTest, UnknownDtypeThrows)
+{
+    shiva::ShivaMessage message;
+    message.tensors.push_back(createTensor<uint8_t>({1}));
+    std::vector<uint8_t> bytes = message.serialize();
+    bytes[13] = 99;
+
+    SocketPair pair;
+    shiva::utils::SocketSend(pair.fds[0], bytes.data(), bytes.size(), "Message");
+    EXPECT_ANY_THROW(shiva::ShivaMessage::receive(pair.fds[1]));
+}
+
+TEST(ShivaMessageTest, ClosedPeerThrows)
+{
+    SocketPair pair;
+    ::shutdown(pair.fds[0], SHUT_WR);
+    EXPECT_ANY_THROW(shiva::ShivaMessage::receive(pair.fds[1]));
+}
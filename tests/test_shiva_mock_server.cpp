@@ -0,0 +1,180 @@
+#include <chrono>
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "shiva/shiva_client.hpp"
+#include "shiva/shiva_mock_server.hpp"
+#include "test_utils.hpp"
+
+using shiva_test::createMessage;
+using shiva_test::SocketPair;
+
+namespace
+{
+    int openFileDescriptors()
+    {
+        int count = 0;
+        DIR *dir = opendir("/proc/self/fd");
+        while (dir != nullptr && readdir(dir) != nullptr)
+            count++;
+        if (dir != nullptr)
+            closedir(dir);
+        return count;
+    }
+
+    void expectEcho(shiva::ShivaMessage &sent, shiva::ShivaMessage &received)
+    {
+        ASSERT_EQ(received.tensors.size(), sent.tensors.size());
+        EXPECT_EQ(received.serialize(), sent.serialize());
+    }
+}
+
+TEST(ShivaMockServerTest, Echo)
+{
+    shiva::ShivaMockServer server;
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+
+    shiva::ShivaMessage message = createMessage({64, 48, 3});
+    for (int i = 0; i < 3; i++)
+    {
+        shiva::ShivaMessage response = client.sendAndReceiveMessage(message);
+        expectEcho(message, response);
+    }
+    EXPECT_EQ(server.messageCount(), 3u);
+}
+
+TEST(ShivaMockServerTest, MultipleConnections)
+{
+    shiva::ShivaMockServer server;
+    std::vector<std::thread> threads;
+    std::atomic<int> answered(0);
+
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back(
+            [&]()
+            {
+                shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+                shiva::ShivaMessage message = createMessage({32, 32});
+                for (int i = 0; i < 10; i++)
+                {
+                    shiva::ShivaMessage response = client.sendAndReceiveMessage(message);
+                    if (response.serialize() == message.serialize())
+                        answered++;
+                }
+            });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(answered, 40);
+}
+
+TEST(ShivaMockServerTest, ClosedConnectionsAreReleased)
+{
+    shiva::ShivaMockServer server;
+    shiva::ShivaMessage message = createMessage({8, 8});
+
+    auto connectOnce = [&]()
+    {
+        shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+        client.sendAndReceiveMessage(message);
+    };
+    auto waitIdle = [&]()
+    {
+        for (int i = 0; i < 200 && server.connectionCount() > 0; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return server.connectionCount();
+    };
+
+    connectOnce();
+    ASSERT_EQ(waitIdle(), 0u);
+    int baseline = openFileDescriptors();
+
+    for (int i = 0; i < 20; i++)
+        connectOnce();
+
+    // sockets are closed as soon as each client is gone, not at stop()
+    EXPECT_EQ(waitIdle(), 0u);
+    EXPECT_EQ(openFileDescriptors(), baseline);
+    EXPECT_EQ(server.messageCount(), 21u);
+}
+
+TEST(ShivaMockServerTest, Transform)
+{
+    shiva::ShivaMockServer::Options options;
+    options.handler = [](const shiva::ShivaMessage &request)
+    {
+        shiva::ShivaMessage response = request;
+        response.metadata["counter"] = request.metadata["counter"].get<int>() + 1;
+        response.tensors.clear();
+        return response;
+    };
+    shiva::ShivaMockServer server(options);
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+
+    shiva::ShivaMessage message = createMessage({8, 8});
+    for (int i = 1; i <= 3; i++)
+    {
+        message = client.sendAndReceiveMessage(message);
+        EXPECT_EQ(message.metadata["counter"], i);
+    }
+    EXPECT_EQ(message.tensors.size(), 0u);
+}
+
+TEST(ShivaMockServerTest, ChunkedWrites)
+{
+    shiva::ShivaMockServer::Options options;
+    options.writeChunkSize = 7;
+    options.writeChunkDelayUs = 1;
+    shiva::ShivaMockServer server(options);
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+
+    shiva::ShivaMessage message = createMessage({16, 9});
+    shiva::ShivaMessage response = client.sendAndReceiveMessage(message);
+    expectEcho(message, response);
+}
+
+TEST(ShivaMockServerTest, SlowReader)
+{
+    shiva::ShivaMockServer::Options options;
+    options.readDelayMs = 50;
+    options.receiveBufferSize = 4096;
+    shiva::ShivaMockServer server(options);
+    shiva::ShivaClient client("127.0.0.1", server.port(), 2000);
+
+    shiva::ShivaMessage message = createMessage({256, 256});
+    auto start = std::chrono::steady_clock::now();
+    shiva::ShivaMessage response = client.sendAndReceiveMessage(message);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    expectEcho(message, response);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(50));
+}
+
+TEST(ShivaMockServerTest, DelayTriggersClientTimeout)
+{
+    shiva::ShivaMockServer::Options options;
+    options.delayMs = 300;
+    shiva::ShivaMockServer server(options);
+    shiva::ShivaClient client("127.0.0.1", server.port(), 100);
+
+    shiva::ShivaMessage message = createMessage({4, 4});
+    EXPECT_THROW(client.sendAndReceiveMessage(message), shiva::ShivaTimeoutException);
+}
+
+TEST(ShivaMockServerTest, ServeSocketPair)
+{
+    shiva::ShivaMockServer server;
+    SocketPair pair;
+    std::thread serving([&]() { server.serve(pair.fds[1]); });
+
+    shiva::ShivaMessage message = createMessage({5, 5});
+    message.sendMessage(pair.fds[0]);
+    shiva::ShivaMessage response = shiva::ShivaMessage::receive(pair.fds[0]);
+    expectEcho(message, response);
+
+    ::shutdown(pair.fds[0], SHUT_RDWR);
+    serving.join();
+}
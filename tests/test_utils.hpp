@@ -0,0 +1,73 @@
+#ifndef SHIVA_TEST_UTILS_HPP
+#define SHIVA_TEST_UTILS_HPP
+
+#include <sys/socket.h>
+#include <thread>
+
+#include "shiva/shiva_message.hpp"
+
+namespace shiva_test
+{
+    /**
+     * Connected pair of local sockets, closed on destruction.
+     */
+    struct SocketPair
+    {
+        int fds[2];
+
+        SocketPair()
+        {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+                throw std::runtime_error("socketpair failed");
+        }
+
+        ~SocketPair()
+        {
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+    };
+
+    template <typename T>
+    typename shiva::Tensor<T>::Ptr createTensor(const std::vector<uint32_t> &shape)
+    {
+        typename shiva::Tensor<T>::Ptr tensor = std::make_shared<shiva::Tensor<T>>();
+        size_t elements = 1;
+        for (uint32_t n : shape)
+            elements *= n;
+        tensor->data.reserve(elements);
+        for (size_t i = 0; i < elements; i++)
+            tensor->data.push_back((T)(i * 7 + 3));
+        tensor->shape = shape;
+        return tensor;
+    }
+
+    /**
+     * Typical inference request: an image, a small float matrix, metadata and a
+     * namespace.
+     */
+    inline shiva::ShivaMessage createMessage(const std::vector<uint32_t> &shape,
+                                             int counter = 0)
+    {
+        shiva::ShivaMessage message;
+        message.tensors.push_back(createTensor<uint8_t>(shape));
+        message.tensors.push_back(createTensor<float>({4, 4}));
+        message.metadata = {{"counter", counter}, {"__tensors__", {"image", "matrix"}}};
+        message.namespace_ = "inference";
+        return message;
+    }
+
+    /**
+     * Send the message on one end of a socketpair and receive it on the other.
+     */
+    inline shiva::ShivaMessage roundTrip(shiva::ShivaMessage &message)
+    {
+        SocketPair pair;
+        std::thread sender([&]() { message.sendMessage(pair.fds[0]); });
+        shiva::ShivaMessage received = shiva::ShivaMessage::receive(pair.fds[1]);
+        sender.join();
+        return received;
+    }
+}
+
+#endif // SHIVA_TEST_UTILS_HPP